@@ -1,20 +1,68 @@
 #define _CRT_SECURE_NO_WARNINGS
 #define _HAS_ITERATOR_DEBUGGING 0 // stl is slow in debug!
 
-#include <windows.h>  // for bitmap headers.  Sorry non windows people!
-#undef min
-#undef max
+#if defined(_WIN32)
+	#include <windows.h>  // for mapping files
+	#undef min
+	#undef max
+#endif
 
 #include <vector>
+#include <array>
+#include <string>
+#include <list>
+#include <deque>
+#include <unordered_map>
 #include <algorithm>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
 #include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+
+#if !defined(_WIN32)
+	#include <sys/socket.h>
+	#include <sys/un.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+	#include <malloc.h>
+#endif
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define WAVE_SIMD_AVX2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define WAVE_SIMD_NEON 1
+#endif
 
 typedef uint8_t uint8;
+typedef uint16_t uint16;
 typedef uint32_t uint32;
 typedef uint64_t uint64;
 
-#define TRACE_LEVEL() 1
+#define TRACE_LEVEL() 0
+
+// Set to 0 to compile out the PROFILE_SCOPE() timers and PROFILE_COUNT() counters
+#define PROFILE_LEVEL() 1
+
+// Set to 1 to cross check every propagator lookup against a brute force PatternMatches() call
+#define VERIFY_PROPAGATOR() 0
 
 #if TRACE_LEVEL() > 0
 	#define TRACE printf
@@ -28,6 +76,136 @@ typedef uint64_t uint64;
 //                                                      MISC
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+typedef std::chrono::high_resolution_clock TClock;
+
+inline double SecondsSince (TClock::time_point start)
+{
+	return std::chrono::duration<double>(TClock::now() - start).count();
+}
+
+inline size_t GetDefaultThreadCount ()
+{
+	size_t numThreads = std::thread::hardware_concurrency();
+	return numThreads > 0 ? numThreads : 1;
+}
+
+// Fork / join: splits [0, count) into numThreads contiguous ranges and calls f(begin, end, threadIndex) for each range on it's own
+// thread, returning once they have all finished.  Range 0 runs on the calling thread.
+template <typename LAMBDA>
+void ParallelFor (size_t count, size_t numThreads, LAMBDA&& f)
+{
+	numThreads = std::max<size_t>(1, std::min(numThreads, count));
+	std::vector<std::thread> threads;
+	threads.reserve(numThreads - 1);
+	for (size_t threadIndex = 1; threadIndex < numThreads; ++threadIndex)
+	{
+		threads.emplace_back(
+			[&f, count, numThreads, threadIndex] ()
+			{
+				f(count * threadIndex / numThreads, count * (threadIndex + 1) / numThreads, threadIndex);
+			}
+		);
+	}
+	f(0, count / numThreads, 0);
+	for (std::thread& thread : threads)
+		thread.join();
+}
+
+// Threads that stay parked on a condition variable between Run() calls, for fork / join work that happens too often to start new
+// threads for each time
+struct SWorkerPool
+{
+	SWorkerPool ()
+		: m_job(nullptr)
+		, m_invoke(nullptr)
+		, m_generation(0)
+		, m_running(0)
+		, m_stopping(false)
+	{ }
+
+	~SWorkerPool ()
+	{
+		Stop();
+	}
+
+	size_t NumThreads () const { return m_threads.size() + 1; }
+
+	// Makes sure there are numThreads - 1 parked threads, the calling thread being the other one
+	void Start (size_t numThreads)
+	{
+		numThreads = std::max<size_t>(1, numThreads);
+		if (NumThreads() == numThreads)
+			return;
+		Stop();
+		m_stopping = false;
+
+		// a new thread waits for the job after the current one, even if it only gets going once that has been run
+		for (size_t threadIndex = 1; threadIndex < numThreads; ++threadIndex)
+			m_threads.emplace_back(&SWorkerPool::Work, this, threadIndex, m_generation);
+	}
+
+	void Stop ()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_wakeCondition.notify_all();
+		for (std::thread& thread : m_threads)
+			thread.join();
+		m_threads.clear();
+	}
+
+	// Calls f(threadIndex) for every thread index in [0, NumThreads()), with 0 on the calling thread, returning once they have all finished
+	template <typename LAMBDA>
+	void Run (LAMBDA&& f)
+	{
+		if (!m_threads.empty())
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_job = &f;
+			m_invoke = [] (const void* job, size_t threadIndex) { (*(typename std::remove_reference<LAMBDA>::type*)job)(threadIndex); };
+			m_running = m_threads.size();
+			++m_generation;
+		}
+		m_wakeCondition.notify_all();
+		f(0);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_doneCondition.wait(lock, [this] () { return m_running == 0; });
+	}
+
+private:
+	void Work (size_t threadIndex, uint64 generation)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (1)
+		{
+			m_wakeCondition.wait(lock, [this, generation] () { return m_stopping || m_generation != generation; });
+			if (m_stopping)
+				return;
+			generation = m_generation;
+			lock.unlock();
+
+			m_invoke(m_job, threadIndex);
+
+			lock.lock();
+			if (--m_running == 0)
+				m_doneCondition.notify_one();
+		}
+	}
+
+	std::vector<std::thread>	m_threads;
+	std::mutex					m_mutex;
+	std::condition_variable		m_wakeCondition;	// there's a new job, or we're stopping
+	std::condition_variable		m_doneCondition;	// the last thread finished the job
+	const void*					m_job;
+	void						(*m_invoke) (const void* job, size_t threadIndex);
+	uint64						m_generation;		// how many jobs have been run
+	size_t						m_running;			// threads still working on the current job
+	bool						m_stopping;
+};
+
 // TODO: could fold the PRNG into context.
 // TODO: we don't need RandomDistribution anymore!
 struct SPRNG
@@ -35,13 +213,16 @@ struct SPRNG
     SPRNG (uint32 seed = -1)
     {
         static std::random_device rd;
-        m_rng.seed(seed == -1 ? rd() : seed);
+        m_seed = seed == -1 ? rd() : seed;
+        m_rng.seed(m_seed);
     }
 
+    uint32 Seed () const { return m_seed; }
+
     template <typename T>
     T RandomInt (T min = std::numeric_limits<T>::min(), T max = std::numeric_limits<T>::max())
     {
-        static std::uniform_int<T> dist(min, max);
+        std::uniform_int_distribution<T> dist(min, max);
         return dist(m_rng);
     }
 
@@ -68,17 +249,142 @@ bool operator == (const SPixel& a, const SPixel& b)
 	return a.B == b.B && a.G == b.G && a.R == b.R;
 }
 
-enum class EPalletIndex : uint64 { e_undecided = (uint64)-1 };
+// A flat array of indices (pallete colors, patterns, positions) stored as the narrowest of uint8, uint16 or uint32 that can hold
+// every index plus a "none" marker.  Hot loops call Dispatch() once to get a pointer of the right type and run as a template from there.
+struct SIndexArray
+{
+	SIndexArray()
+		: m_width(4)
+		, m_size(0)
+	{ }
+
+	// sets the element width for indices in [0, numValues) and sets every element to None()
+	void Init (size_t numValues, size_t size)
+	{
+		m_width = numValues < 0xFF ? 1 : (numValues < 0xFFFF ? 2 : 4);
+		m_size = size;
+		m_bytes.assign(size * m_width, 0xFF);
+	}
+
+	size_t Width () const { return m_width; }
+	size_t Size () const { return m_size; }
+	size_t Bytes () const { return m_bytes.size(); }
+	uint32 None () const { return m_width == 4 ? (uint32)-1 : ((uint32)1 << (m_width * 8)) - 1; }
+
+	template <typename T>
+	T* Data () { return (T*)m_bytes.data(); }
+
+	template <typename T>
+	const T* Data () const { return (const T*)m_bytes.data(); }
+
+	uint32 Get (size_t index) const
+	{
+		switch (m_width)
+		{
+			case 1: return Data<uint8>()[index];
+			case 2: return Data<uint16>()[index];
+			default: return Data<uint32>()[index];
+		}
+	}
+
+	void Set (size_t index, uint32 value)
+	{
+		switch (m_width)
+		{
+			case 1: Data<uint8>()[index] = (uint8)value; break;
+			case 2: Data<uint16>()[index] = (uint16)value; break;
+			default: Data<uint32>()[index] = value; break;
+		}
+	}
+
+	template <typename T>
+	void Append (const T* values, size_t count)
+	{
+		m_bytes.insert(m_bytes.end(), (const uint8*)values, (const uint8*)(values + count));
+		m_size += count;
+	}
+
+	// calls f() with a typed pointer to the elements
+	template <typename LAMBDA>
+	void Dispatch (LAMBDA&& f) const
+	{
+		switch (m_width)
+		{
+			case 1: f(Data<uint8>()); break;
+			case 2: f(Data<uint16>()); break;
+			default: f(Data<uint32>()); break;
+		}
+	}
+
+	template <typename LAMBDA>
+	void Dispatch (LAMBDA&& f)
+	{
+		switch (m_width)
+		{
+			case 1: f(Data<uint8>()); break;
+			case 2: f(Data<uint16>()); break;
+			default: f(Data<uint32>()); break;
+		}
+	}
+
+private:
+	size_t				m_width;
+	size_t				m_size;
+	std::vector<uint8>	m_bytes;
+};
+
+// What each output pixel was observed to be, as a structure of arrays.  Undecided pixels are None() in every array.
+struct SObservedPixels
+{
+	void Init (size_t numPixels, size_t numColors, size_t numPatterns, size_t numPositions)
+	{
+		m_colors.Init(numColors, numPixels);
+		m_patterns.Init(numPatterns, numPixels);
+		m_positions.Init(numPositions, numPixels);
+	}
+
+	void Clear (size_t pixelIndex)
+	{
+		m_colors.Set(pixelIndex, m_colors.None());
+		m_patterns.Set(pixelIndex, m_patterns.None());
+		m_positions.Set(pixelIndex, m_positions.None());
+	}
+
+	void Set (size_t pixelIndex, uint32 color, size_t patternIndex, size_t positionIndex)
+	{
+		m_colors.Set(pixelIndex, color);
+		m_patterns.Set(pixelIndex, (uint32)patternIndex);
+		m_positions.Set(pixelIndex, (uint32)positionIndex);
+	}
+
+	void Copy (size_t pixelIndex, const SObservedPixels& src, size_t srcPixelIndex)
+	{
+		Set(pixelIndex, src.m_colors.Get(srcPixelIndex), src.m_patterns.Get(srcPixelIndex), src.m_positions.Get(srcPixelIndex));
+	}
+
+	size_t Possibility (size_t pixelIndex, size_t numPositions) const
+	{
+		return m_patterns.Get(pixelIndex) * numPositions + m_positions.Get(pixelIndex);
+	}
 
-struct SObservedPixel
+	SIndexArray	m_colors;
+	SIndexArray	m_patterns;
+	SIndexArray	m_positions;
+};
+
+// a pixel that is decided on before solving starts
+struct SPinnedPixel
 {
-	EPalletIndex	m_observedColor;
-	size_t			m_patternIndex;
-	size_t			m_positionIndex;
+	size_t	m_pixelIndex;
+	size_t	m_possibility;
 };
 
-typedef std::vector<bool>			TSuperpositionalPixels;
-typedef std::vector<SObservedPixel>	TObservedPixels;
+// a pixel that has to end up a pallete color, with any possibility that gives it that color
+struct SPinnedColor
+{
+	size_t	m_pixelIndex;
+	uint32	m_color;
+};
 
 struct SPalletizedImageData
 {
@@ -90,804 +396,6302 @@ struct SPalletizedImageData
 	size_t m_width;
 	size_t m_height;
 	size_t m_bpp;
-	std::vector<EPalletIndex> m_pixels;
+	SIndexArray m_pixels;
 	std::vector<SPixel> m_pallete;
 };
 
-struct SImageData
-{
-	SImageData()
-		: m_width(0)
-		, m_height(0)
-	{ }
+template <typename T>
+using TPattern = std::vector<T>;
 
-	size_t m_width;
-	size_t m_height;
-	size_t m_pitch;
-	std::vector<uint8> m_pixels;
-};
+// All of the unique patterns found in the source image, stored back to back in one flat buffer.  Patterns are interned in an open
+// addressing hash table keyed by a hash of their pixels, so finding or adding a pattern is O(1) amortized.
+struct SPatternTable
+{
+	static const size_t c_notFound = (size_t)-1;
 
-typedef std::vector<EPalletIndex> TPattern;
+	// numColors is the pallete size, which picks how narrow the stored pattern pixels are
+	void Init (size_t tileSize, size_t numColors)
+	{
+		m_patternSize = tileSize * tileSize;
+		m_pixels.Init(numColors, 0);
+		m_counts.clear();
+		m_hashes.clear();
+		m_slots.assign(64, c_emptySlot);
+	}
 
-struct SPattern
-{
-	TPattern	m_pattern;
-	uint64		m_count;
-};
+	size_t Size () const { return m_counts.size(); }
+	uint64 Count (size_t index) const { return m_counts[index]; }
+	uint32 Pixel (size_t index, size_t position) const { return m_pixels.Get(index * m_patternSize + position); }
 
-typedef std::vector<SPattern> TPatternList;
+	// T must match m_pixels.Width()
+	template <typename T>
+	const T* Pattern (size_t index) const { return m_pixels.Data<T>() + index * m_patternSize; }
 
-struct SContext
-{
-	SContext(uint32 prngSeed = -1)
-		: m_prng(prngSeed)
-	{ }
-	SPRNG		m_prng;
+	template <typename T>
+	size_t Find (const T* pattern, uint64 hash) const
+	{
+		for (size_t slot = SlotForHash(hash); m_slots[slot] != c_emptySlot; slot = (slot + 1) & (m_slots.size() - 1))
+		{
+			size_t index = m_slots[slot];
+			if (m_hashes[index] == hash && std::equal(pattern, pattern + m_patternSize, Pattern<T>(index)))
+				return index;
+		}
+		return c_notFound;
+	}
 
-	SImageData				m_colorImage;
-	SPalletizedImageData	m_palletizedImage;
+	// Adds count to the pattern's count, adding the pattern to the end of the table first if it isn't already in it.  Returns it's index.
+	template <typename T>
+	size_t Add (const T* pattern, uint64 hash, uint64 count)
+	{
+		size_t slot = SlotForHash(hash);
+		for (; m_slots[slot] != c_emptySlot; slot = (slot + 1) & (m_slots.size() - 1))
+		{
+			size_t index = m_slots[slot];
+			if (m_hashes[index] == hash && std::equal(pattern, pattern + m_patternSize, Pattern<T>(index)))
+			{
+				m_counts[index] += count;
+				return index;
+			}
+		}
+		return Insert(pattern, hash, count, slot);
+	}
 
-	TPatternList			m_patterns;
+	// Adds the pattern to the end of the table even if it's already in it, and returns it's index.  Find() and Add() see the first copy.
+	template <typename T>
+	size_t Append (const T* pattern, uint64 hash, uint64 count)
+	{
+		size_t slot = SlotForHash(hash);
+		while (m_slots[slot] != c_emptySlot)
+			slot = (slot + 1) & (m_slots.size() - 1);
+		return Insert(pattern, hash, count, slot);
+	}
 
-	std::vector<bool>		m_changedPixels;
+private:
+	static const uint32 c_emptySlot = (uint32)-1;
 
-	TSuperpositionalPixels	m_superPositionalPixels;
+	template <typename T>
+	size_t Insert (const T* pattern, uint64 hash, uint64 count, size_t slot)
+	{
+		size_t index = m_counts.size();
+		m_pixels.Append(pattern, m_patternSize);
+		m_counts.push_back(count);
+		m_hashes.push_back(hash);
+		m_slots[slot] = (uint32)index;
+
+		// keep the table at most half full
+		if (m_counts.size() * 2 > m_slots.size())
+			Rehash(m_slots.size() * 2);
+		return index;
+	}
 
-	TObservedPixels			m_observedPixels;
+	size_t SlotForHash (uint64 hash) const
+	{
+		hash ^= hash >> 31;
+		hash *= 0xBF58476D1CE4E5B9ull;
+		hash ^= hash >> 29;
+		return (size_t)hash & (m_slots.size() - 1);
+	}
 
-	size_t		m_tileSize;
-	const char* m_fileName;
-	bool		m_periodicInput;
-	bool		m_periodicOutput;
-	uint8		m_symmetry;
-	size_t		m_outputImageWidth;
-	size_t		m_outputImageHeight;
-	size_t		m_numPixels;
-	size_t		m_boolsPerPixel;
+	void Rehash (size_t numSlots)
+	{
+		m_slots.assign(numSlots, c_emptySlot);
+		for (size_t index = 0; index < m_counts.size(); ++index)
+		{
+			size_t slot = SlotForHash(m_hashes[index]);
+			while (m_slots[slot] != c_emptySlot)
+				slot = (slot + 1) & (m_slots.size() - 1);
+			m_slots[slot] = (uint32)index;
+		}
+	}
 
-	std::vector<std::vector<size_t>>	m_propagator;
+public:
+	size_t						m_patternSize;
+	SIndexArray					m_pixels;	// [pattern][tileSize*tileSize]
+	std::vector<uint64>			m_counts;
+	std::vector<uint64>			m_hashes;
+	std::vector<uint32>			m_slots;	// indices into the patterns, or c_emptySlot
 };
 
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//                                                BMP LOADING AND SAVING
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+const size_t SPatternTable::c_notFound;
+const uint32 SPatternTable::c_emptySlot;
 
-bool LoadImage (const char *fileName, SImageData& imageData)
+// A read only view of a whole file mapped into memory.  The mapping goes away with the object.
+struct SMappedFile
 {
-    // open the file if we can
-    FILE *file;
-    file = fopen(fileName, "rb");
-    if (!file)
-        return false;
- 
-    // read the headers if we can
-    BITMAPFILEHEADER header;
-    BITMAPINFOHEADER infoHeader;
-    if (fread(&header, sizeof(header), 1, file) != 1 ||
-        fread(&infoHeader, sizeof(infoHeader), 1, file) != 1 ||
-        header.bfType != 0x4D42 || infoHeader.biBitCount != 24)
-    {
-        fclose(file);
-        return false;
-    }
- 
-    // read in our pixel data if we can. Note that it's in BGR order, and width is padded to the next power of 4
-    imageData.m_pixels.resize(infoHeader.biSizeImage);
-    fseek(file, header.bfOffBits, SEEK_SET);
-    if (fread(&imageData.m_pixels[0], imageData.m_pixels.size(), 1, file) != 1)
-    {
-        fclose(file);
-        return false;
-    }
- 
-    imageData.m_width = infoHeader.biWidth;
-    imageData.m_height = infoHeader.biHeight;
- 
-	// calculate pitch
-    imageData.m_pitch = imageData.m_width*3;
-    if (imageData.m_pitch & 3)
-    {
-        imageData.m_pitch &= ~3;
-        imageData.m_pitch += 4;
-    }
- 
-    fclose(file);
-    return true;
-}
- 
-bool SaveImage (const char *fileName, const SImageData &image)
-{
-    // open the file if we can
-    FILE *file;
-    file = fopen(fileName, "wb");
-    if (!file)
-        return false;
- 
-    // make the header info
-    BITMAPFILEHEADER header;
-    BITMAPINFOHEADER infoHeader;
- 
-    header.bfType = 0x4D42;
-    header.bfReserved1 = 0;
-    header.bfReserved2 = 0;
-    header.bfOffBits = 54;
- 
-    infoHeader.biSize = 40;
-    infoHeader.biWidth = (long)image.m_width;
-    infoHeader.biHeight = (long)image.m_height;
-    infoHeader.biPlanes = 1;
-    infoHeader.biBitCount = 24;
-    infoHeader.biCompression = 0;
-    infoHeader.biSizeImage = (DWORD)image.m_pixels.size();
-    infoHeader.biXPelsPerMeter = 0;
-    infoHeader.biYPelsPerMeter = 0;
-    infoHeader.biClrUsed = 0;
-    infoHeader.biClrImportant = 0;
- 
-    header.bfSize = infoHeader.biSizeImage + header.bfOffBits;
- 
-    // write the data and close the file
-    fwrite(&header, sizeof(header), 1, file);
-    fwrite(&infoHeader, sizeof(infoHeader), 1, file);
-    fwrite(&image.m_pixels[0], infoHeader.biSizeImage, 1, file);
-    fclose(file);
-    return true;
-}
+	SMappedFile ()
+		: m_data(nullptr)
+		, m_size(0)
+		#ifdef _WIN32
+		, m_file(INVALID_HANDLE_VALUE)
+		, m_mapping(nullptr)
+		#endif
+	{ }
 
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//                                                IMAGE PALLETIZATION
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	~SMappedFile ()
+	{
+		Close();
+	}
 
-EPalletIndex GetOrMakePalleteIndex (SPalletizedImageData& palletizedImage, const SPixel& pixel)
-{
-	// see if this pixel value already exists in the pallete
-	auto it = std::find(palletizedImage.m_pallete.begin(), palletizedImage.m_pallete.end(), pixel);
+	SMappedFile (const SMappedFile&) = delete;
+	SMappedFile& operator = (const SMappedFile&) = delete;
 
-	// if it was found, return it's index
-	if (it != palletizedImage.m_pallete.end())
-		return (EPalletIndex)(it - palletizedImage.m_pallete.begin());
+	bool Open (const char* fileName)
+	{
+		Close();
+		#ifdef _WIN32
+		m_file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		LARGE_INTEGER size;
+		if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		m_data = m_mapping ? (const uint8*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		m_size = (size_t)size.QuadPart;
+		#else
+		int file = open(fileName, O_RDONLY);
+		struct stat info;
+		if (file < 0 || fstat(file, &info) != 0 || info.st_size == 0)
+		{
+			if (file >= 0)
+				close(file);
+			return false;
+		}
+		void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		close(file);
+		m_data = data != MAP_FAILED ? (const uint8*)data : nullptr;
+		m_size = (size_t)info.st_size;
+		#endif
+		if (!m_data)
+		{
+			Close();
+			return false;
+		}
+		return true;
+	}
 
-	// else add it
-	palletizedImage.m_pallete.push_back(pixel);
-	return (EPalletIndex)(palletizedImage.m_pallete.size()-1);
-}
+	void Close ()
+	{
+		#ifdef _WIN32
+		if (m_data)
+			UnmapViewOfFile(m_data);
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+		m_mapping = nullptr;
+		#else
+		if (m_data)
+			munmap((void*)m_data, m_size);
+		#endif
+		m_data = nullptr;
+		m_size = 0;
+	}
 
-void PalletizeImageRow (const SImageData& colorImage, SPalletizedImageData& palletizedImage, size_t y)
-{
-	// get source and dest pointers for this row
-	const SPixel* srcPixel = (SPixel*)&colorImage.m_pixels[y * colorImage.m_pitch];
-	EPalletIndex* destPixel = &palletizedImage.m_pixels[y * palletizedImage.m_width];
+	const uint8*	m_data;
+	size_t			m_size;
 
-	// set the palletized pixel index to be the pallet index for the source pixel color
-	for (size_t x = 0; x < colorImage.m_width; ++x, ++srcPixel, ++destPixel)
-		*destPixel = GetOrMakePalleteIndex(palletizedImage, *srcPixel);
-}
+private:
+	#ifdef _WIN32
+	HANDLE			m_file;
+	HANDLE			m_mapping;
+	#endif
+};
 
-void PalletizeImage (const SImageData& colorImage, SPalletizedImageData& palletizedImage)
+// A file created at a fixed size and mapped for writing, so it can be filled in place, in any order, with no buffering or copies.
+// The mapping is flushed and goes away on Close() or with the object.
+struct SMappedOutputFile
 {
-	// copy properties of color image to palletized image
-	palletizedImage.m_width = colorImage.m_width;
-	palletizedImage.m_height = colorImage.m_height;
-	palletizedImage.m_pixels.resize(palletizedImage.m_width*palletizedImage.m_height);
-
-	// process a row of data
-	for (size_t y = 0; y < colorImage.m_height; ++y)
-		PalletizeImageRow(colorImage, palletizedImage, y);
+	SMappedOutputFile ()
+		: m_data(nullptr)
+		, m_size(0)
+		#ifdef _WIN32
+		, m_file(INVALID_HANDLE_VALUE)
+		, m_mapping(nullptr)
+		#else
+		, m_file(-1)
+		#endif
+	{ }
 
-	// calculate bits per pixel
-	size_t maxValue = 2;
-	palletizedImage.m_bpp = 1;
-	while (maxValue < palletizedImage.m_pallete.size())
+	~SMappedOutputFile ()
 	{
-		maxValue *= 2;
-		++palletizedImage.m_bpp;
+		Close();
 	}
-}
 
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//                                                PATTERN GATHERING
-/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+	SMappedOutputFile (const SMappedOutputFile&) = delete;
+	SMappedOutputFile& operator = (const SMappedOutputFile&) = delete;
 
-void GetPattern (const SPalletizedImageData& palletizedImage, size_t startX, size_t startY, size_t tileSize, TPattern& outPattern)
-{
-	EPalletIndex* outPixel = &outPattern[0];
-	for (size_t iy = 0; iy < tileSize; ++iy)
+	bool Create (const char* fileName, size_t size)
 	{
-		size_t y = (startY + iy) % palletizedImage.m_height;
-		for (size_t ix = 0; ix < tileSize; ++ix)
+		Close();
+		#ifdef _WIN32
+		m_file = CreateFileA(fileName, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE)
+			return false;
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE, (DWORD)((uint64)size >> 32), (DWORD)size, nullptr);
+		m_data = m_mapping ? (uint8*)MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, 0) : nullptr;
+		#else
+		m_file = open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (m_file < 0 || ftruncate(m_file, (off_t)size) != 0)
 		{
-			size_t x = (startX + ix) % palletizedImage.m_width;
-			*outPixel = palletizedImage.m_pixels[y*palletizedImage.m_width + x];
-			++outPixel;
+			Close();
+			return false;
+		}
+		void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+		m_data = data != MAP_FAILED ? (uint8*)data : nullptr;
+		#endif
+		m_size = size;
+		if (!m_data)
+		{
+			Close();
+			return false;
 		}
+		return true;
 	}
-}
 
-void AddPattern (TPatternList& patterns, const TPattern& pattern)
+	// returns false if the file couldn't be written
+	bool Close ()
+	{
+		bool success = true;
+		#ifdef _WIN32
+		if (m_data)
+			success &= UnmapViewOfFile(m_data) != 0;
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			success &= CloseHandle(m_file) != 0;
+		m_file = INVALID_HANDLE_VALUE;
+		m_mapping = nullptr;
+		#else
+		if (m_data)
+			success &= munmap(m_data, m_size) == 0;
+		if (m_file >= 0)
+			success &= close(m_file) == 0;
+		m_file = -1;
+		#endif
+		m_data = nullptr;
+		m_size = 0;
+		return success;
+	}
+
+	uint8*			m_data;
+	size_t			m_size;
+
+private:
+	#ifdef _WIN32
+	HANDLE			m_file;
+	HANDLE			m_mapping;
+	#else
+	int				m_file;
+	#endif
+};
+
+// A file written with positional writes, so the parts of it can be written in any order and from any one thread
+struct SOutputFile
 {
-	auto it = std::find_if(
-		patterns.begin(),
-		patterns.end(),
-		[&] (const SPattern& listPattern)
-		{
-			return listPattern.m_pattern == pattern;
-		}
-	);
+	SOutputFile ()
+		#ifdef _WIN32
+		: m_file(INVALID_HANDLE_VALUE)
+		#else
+		: m_file(-1)
+		#endif
+	{ }
 
-	if (it != patterns.end())
+	~SOutputFile ()
 	{
-		(*it).m_count++;
+		Close();
 	}
-	else
+
+	SOutputFile (const SOutputFile&) = delete;
+	SOutputFile& operator = (const SOutputFile&) = delete;
+
+	bool Create (const char* fileName)
 	{
-		SPattern newPattern;
-		newPattern.m_count = 1;
-		newPattern.m_pattern = pattern;
-		patterns.push_back(newPattern);
+		Close();
+		#ifdef _WIN32
+		m_file = CreateFileA(fileName, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		return m_file != INVALID_HANDLE_VALUE;
+		#else
+		m_file = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		return m_file >= 0;
+		#endif
 	}
-}
 
-void ReflectPatternXAxis (const TPattern& inPattern, TPattern& outPattern, size_t tileSize)
-{
-	for (size_t outY = 0; outY < tileSize; ++outY)
+	bool WriteAt (uint64 offset, const void* data, size_t size)
 	{
-		for (size_t outX = 0; outX < tileSize; ++outX)
+		#ifdef _WIN32
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = (DWORD)offset;
+		overlapped.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD written = 0;
+		return WriteFile(m_file, data, (DWORD)size, &written, &overlapped) && written == size;
+		#else
+		const uint8* bytes = (const uint8*)data;
+		while (size > 0)
 		{
-			size_t outIndex = outY * tileSize + outX;
-
-			size_t inX = tileSize - 1 - outX;
-			size_t inY = outY;
-			size_t inIndex = inY * tileSize + inX;
-			
-			outPattern[outIndex] = inPattern[inIndex];
+			ssize_t written = pwrite(m_file, bytes, size, (off_t)offset);
+			if (written <= 0)
+				return false;
+			bytes += written;
+			offset += (uint64)written;
+			size -= (size_t)written;
 		}
+		return true;
+		#endif
 	}
-}
 
-void RotatePatternCW90 (const TPattern& inPattern, TPattern& outPattern, size_t tileSize)
-{
-	for (size_t outY = 0; outY < tileSize; ++outY)
+	// returns false if the file couldn't be written
+	bool Close ()
 	{
-		for (size_t outX = 0; outX < tileSize; ++outX)
-		{
-			size_t outIndex = outY * tileSize + outX;
+		bool success = true;
+		#ifdef _WIN32
+		if (m_file != INVALID_HANDLE_VALUE)
+			success = CloseHandle(m_file) != 0;
+		m_file = INVALID_HANDLE_VALUE;
+		#else
+		if (m_file >= 0)
+			success = close(m_file) == 0;
+		m_file = -1;
+		#endif
+		return success;
+	}
 
-            size_t inX = outY;
-            size_t inY = tileSize - 1 - outX;
+private:
+	#ifdef _WIN32
+	HANDLE	m_file;
+	#else
+	int		m_file;
+	#endif
+};
+
+// How an image's pixels are laid out in memory
+enum class EPixelFormat
+{
+	e_bgr24,		// 24 bit BMP
+	e_bgrx32,		// 32 bit BMP, the fourth byte is ignored
+	e_indexed8,		// 8 bit BMP, indices into m_colorTable
+	e_rgb24			// binary PPM
+};
+
+// Row 0 is the bottom row, like in a bottom up BMP.  A loaded image is a view straight into it's mapped file, in whatever format the
+// file has, and ForEachPixelInRow() converts the pixels as they're read.  Allocate() makes an owned, writable 24 bit image instead.
+struct SImageData
+{
+	SImageData()
+		: m_width(0)
+		, m_height(0)
+		, m_format(EPixelFormat::e_bgr24)
+		, m_rows(nullptr)
+		, m_rowStride(0)
+	{ }
+
+	void Allocate (size_t width, size_t height)
+	{
+		m_mappedFile.reset();
+		m_colorTable.clear();
+		m_width = width;
+		m_height = height;
+		m_format = EPixelFormat::e_bgr24;
+
+		// rows are padded to a multiple of 4 bytes, like in a BMP
+		const size_t pitch = (width * 3 + 3) & ~(size_t)3;
+		m_pixels.assign(pitch * height, 0);
+		m_rows = m_pixels.data();
+		m_rowStride = (ptrdiff_t)pitch;
+	}
+
+	const uint8* Row (size_t y) const { return m_rows + (ptrdiff_t)y * m_rowStride; }
+
+	// only for images made with Allocate()
+	SPixel* MutableRow (size_t y) { return (SPixel*)&m_pixels[y * (size_t)m_rowStride]; }
+
+	// calls f(x, pixel) for each pixel in row y, left to right
+	template <typename LAMBDA>
+	void ForEachPixelInRow (size_t y, LAMBDA&& f) const
+	{
+		const uint8* src = Row(y);
+		switch (m_format)
+		{
+			case EPixelFormat::e_bgr24:
+				for (size_t x = 0; x < m_width; ++x)
+					f(x, *(const SPixel*)&src[x * 3]);
+				break;
+			case EPixelFormat::e_bgrx32:
+				for (size_t x = 0; x < m_width; ++x)
+					f(x, *(const SPixel*)&src[x * 4]);
+				break;
+			case EPixelFormat::e_indexed8:
+				for (size_t x = 0; x < m_width; ++x)
+					f(x, m_colorTable[src[x]]);
+				break;
+			case EPixelFormat::e_rgb24:
+				for (size_t x = 0; x < m_width; ++x)
+					f(x, SPixel{ src[x * 3 + 2], src[x * 3 + 1], src[x * 3] });
+				break;
+		}
+	}
+
+	size_t							m_width;
+	size_t							m_height;
+	EPixelFormat					m_format;
+	const uint8*					m_rows;			// row 0
+	ptrdiff_t						m_rowStride;	// bytes from one row to the next, negative for files that store the top row first
+	std::vector<SPixel>				m_colorTable;	// always 256 entries for e_indexed8
+	std::vector<uint8>				m_pixels;		// an allocated image's pixels
+	std::unique_ptr<SMappedFile>	m_mappedFile;	// or the file a loaded image is a view of
+};
+
+// Which patterns agree with which at each overlapping offset, stored as compressed rows: list i is m_patterns[m_offsets[i]] up to
+// m_patterns[m_offsets[i + 1]].  The rows are either built into the owned arrays, or point straight into a mapped model cache file.
+struct SPropagator
+{
+	struct SList
+	{
+		const uint32* begin () const { return m_begin; }
+		const uint32* end () const { return m_end; }
+		size_t size () const { return m_end - m_begin; }
+
+		const uint32*	m_begin;
+		const uint32*	m_end;
+	};
+
+	SPropagator ()
+		: m_numLists(0)
+		, m_offsets(nullptr)
+		, m_patterns(nullptr)
+	{ }
+
+	// the pointers would dangle in a copy
+	SPropagator (const SPropagator&) = delete;
+	SPropagator& operator = (const SPropagator&) = delete;
+
+	size_t NumLists () const { return m_numLists; }
+	size_t NumEntries () const { return m_numLists > 0 ? (size_t)m_offsets[m_numLists] : 0; }
+	SList List (size_t index) const { return { m_patterns + m_offsets[index], m_patterns + m_offsets[index + 1] }; }
+
+	// Build with BeginList() and AddPattern() calls, then Finish()
+	void Clear ()
+	{
+		m_ownedOffsets.clear();
+		m_ownedPatterns.clear();
+		m_mappedFile.reset();
+		m_numLists = 0;
+		m_offsets = nullptr;
+		m_patterns = nullptr;
+	}
+
+	void BeginList ()
+	{
+		m_ownedOffsets.push_back(m_ownedPatterns.size());
+	}
+
+	void AddPattern (size_t patternIndex)
+	{
+		m_ownedPatterns.push_back((uint32)patternIndex);
+	}
+
+	void Finish ()
+	{
+		m_numLists = m_ownedOffsets.size();
+		m_ownedOffsets.push_back(m_ownedPatterns.size());
+		m_offsets = m_ownedOffsets.data();
+		m_patterns = m_ownedPatterns.data();
+	}
+
+	// Uses numLists lists that are already laid out in a mapped file, and keeps the file mapped for as long as they're used
+	void Map (std::unique_ptr<SMappedFile>&& mappedFile, size_t numLists, const uint64* offsets, const uint32* patterns)
+	{
+		Clear();
+		m_mappedFile = std::move(mappedFile);
+		m_numLists = numLists;
+		m_offsets = offsets;
+		m_patterns = patterns;
+	}
+
+	size_t						m_numLists;
+	const uint64*				m_offsets;		// [numLists + 1]
+	const uint32*				m_patterns;
+
+private:
+	std::vector<uint64>			m_ownedOffsets;
+	std::vector<uint32>			m_ownedPatterns;
+	std::unique_ptr<SMappedFile>	m_mappedFile;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                      PROFILING
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// PROFILE_SCOPE("name") times the rest of the enclosing block, and PROFILE_COUNT(e_counter, amount) adds to one of the counters below.
+// Each thread records into it's own buffer, so nothing is shared or locked in the hot paths.  The totals are reported when the
+// program exits, and with -trace every timed scope is also kept as an event for a chrome://tracing / Perfetto trace file.
+// With PROFILE_LEVEL() 0 the macros compile to nothing.
+
+enum class EProfileCounter
+{
+	e_observations,
+	e_queuePops,
+	e_bans,
+	e_patternCompares,
+	e_contradictions,
+
+	e_count
+};
+
+static const char* c_profileCounterNames[(size_t)EProfileCounter::e_count] =
+{
+	"observations", "propagation queue pops", "bans", "pattern compares", "contradictions"
+};
+
+struct SProfileEvent
+{
+	uint32	m_zoneIndex;
+	uint64	m_startNs;		// since the profiler started
+	uint64	m_durationNs;
+};
+
+struct SProfileThread
+{
+	SProfileThread (size_t threadIndex)
+		: m_threadIndex(threadIndex)
+		, m_counters()
+	{ }
+
+	size_t						m_threadIndex;
+	uint64						m_counters[(size_t)EProfileCounter::e_count];
+	std::vector<uint64>			m_zoneNs;
+	std::vector<uint64>			m_zoneCalls;
+	std::vector<SProfileEvent>	m_events;
+};
+
+struct SProfiler
+{
+	static const size_t c_maxEventsPerThread = 1 << 22;
+
+	static SProfiler& Get ()
+	{
+		static SProfiler profiler;
+		return profiler;
+	}
+
+	size_t AddZone (const char* name)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_zoneNames.push_back(name);
+		return m_zoneNames.size() - 1;
+	}
+
+	// Buffers belong to the profiler, so what short lived ParallelFor() threads recorded is still there for the report.  A thread
+	// gives it's buffer back when it exits, for the next new thread to carry on with, so there are only ever as many buffers as
+	// there were threads alive at once.
+	SProfileThread* AcquireThread ()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_freeThreads.empty())
+		{
+			SProfileThread* thread = m_freeThreads.back();
+			m_freeThreads.pop_back();
+			return thread;
+		}
+		m_threads.emplace_back(new SProfileThread(m_threads.size()));
+		return m_threads.back().get();
+	}
+
+	void ReleaseThread (SProfileThread* thread)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_freeThreads.push_back(thread);
+	}
+
+	// Sums the threads' buffers.  Only call this once the threads that recorded anything are done.
+	void Totals (std::vector<uint64>& zoneNs, std::vector<uint64>& zoneCalls, uint64* counters)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		zoneNs.assign(m_zoneNames.size(), 0);
+		zoneCalls.assign(m_zoneNames.size(), 0);
+		std::fill(counters, counters + (size_t)EProfileCounter::e_count, 0);
+		for (const std::unique_ptr<SProfileThread>& thread : m_threads)
+		{
+			for (size_t zoneIndex = 0; zoneIndex < thread->m_zoneNs.size(); ++zoneIndex)
+			{
+				zoneNs[zoneIndex] += thread->m_zoneNs[zoneIndex];
+				zoneCalls[zoneIndex] += thread->m_zoneCalls[zoneIndex];
+			}
+			for (size_t counterIndex = 0; counterIndex < (size_t)EProfileCounter::e_count; ++counterIndex)
+				counters[counterIndex] += thread->m_counters[counterIndex];
+		}
+	}
+
+	void Report (FILE* file);
+	bool WriteChromeTrace (const char* fileName);
+
+	std::mutex								m_mutex;
+	std::vector<const char*>				m_zoneNames;
+	std::vector<std::unique_ptr<SProfileThread>>	m_threads;
+	std::vector<SProfileThread*>			m_freeThreads;
+	TClock::time_point						m_start = TClock::now();
+	bool									m_recordEvents = false;	// set before any threads start timing things
+};
+
+// the calling thread's buffer
+inline SProfileThread& ProfileThread ()
+{
+	struct SHandle
+	{
+		SHandle () : m_thread(SProfiler::Get().AcquireThread()) { }
+		~SHandle () { SProfiler::Get().ReleaseThread(m_thread); }
+		SProfileThread* m_thread;
+	};
+	thread_local SHandle handle;
+	return *handle.m_thread;
+}
+
+// A named block of code.  PROFILE_SCOPE() makes these function local statics, so each is only registered the first time it runs.
+struct SProfileZone
+{
+	SProfileZone (const char* name)
+		: m_index(SProfiler::Get().AddZone(name))
+	{ }
+
+	size_t	m_index;
+};
+
+struct SProfileScope
+{
+	SProfileScope (const SProfileZone& zone)
+		: m_zoneIndex(zone.m_index)
+		, m_start(TClock::now())
+	{ }
+
+	~SProfileScope ()
+	{
+		TClock::time_point end = TClock::now();
+		SProfileThread& thread = ProfileThread();
+		if (thread.m_zoneNs.size() <= m_zoneIndex)
+		{
+			thread.m_zoneNs.resize(m_zoneIndex + 1, 0);
+			thread.m_zoneCalls.resize(m_zoneIndex + 1, 0);
+		}
+		uint64 durationNs = (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(end - m_start).count();
+		thread.m_zoneNs[m_zoneIndex] += durationNs;
+		++thread.m_zoneCalls[m_zoneIndex];
+
+		SProfiler& profiler = SProfiler::Get();
+		if (profiler.m_recordEvents && thread.m_events.size() < SProfiler::c_maxEventsPerThread)
+		{
+			uint64 startNs = (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(m_start - profiler.m_start).count();
+			thread.m_events.push_back({ (uint32)m_zoneIndex, startNs, durationNs });
+		}
+	}
+
+	size_t				m_zoneIndex;
+	TClock::time_point	m_start;
+};
+
+void SProfiler::Report (FILE* file)
+{
+	std::vector<uint64> zoneNs, zoneCalls;
+	uint64 counters[(size_t)EProfileCounter::e_count];
+	Totals(zoneNs, zoneCalls, counters);
+
+	// busiest first
+	std::vector<size_t> order;
+	for (size_t zoneIndex = 0; zoneIndex < zoneNs.size(); ++zoneIndex)
+	{
+		if (zoneCalls[zoneIndex] > 0)
+			order.push_back(zoneIndex);
+	}
+	std::sort(order.begin(), order.end(), [&] (size_t a, size_t b) { return zoneNs[a] > zoneNs[b]; });
+
+	fprintf(file, "\nProfile (%zu threads, times summed over threads):\n", m_threads.size());
+	fprintf(file, "  %-32s %12s %12s %12s\n", "scope", "calls", "total ms", "avg us");
+	for (size_t zoneIndex : order)
+	{
+		fprintf(file, "  %-32s %12llu %12.3f %12.3f\n", m_zoneNames[zoneIndex], (unsigned long long)zoneCalls[zoneIndex],
+			double(zoneNs[zoneIndex]) / 1000000.0, double(zoneNs[zoneIndex]) / 1000.0 / double(zoneCalls[zoneIndex]));
+	}
+	for (size_t counterIndex = 0; counterIndex < (size_t)EProfileCounter::e_count; ++counterIndex)
+		fprintf(file, "  %-32s %12llu\n", c_profileCounterNames[counterIndex], (unsigned long long)counters[counterIndex]);
+}
+
+// Writes the recorded scopes in the chrome trace event format, as complete ("X") events with microsecond times
+bool SProfiler::WriteChromeTrace (const char* fileName)
+{
+	FILE* file = fopen(fileName, "wt");
+	if (!file)
+		return false;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	bool truncated = false;
+	fprintf(file, "{\"traceEvents\": [\n");
+	const char* separator = "";
+	for (const std::unique_ptr<SProfileThread>& thread : m_threads)
+	{
+		fprintf(file, "%s  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %zu, \"args\": {\"name\": \"thread %zu\"}}",
+			separator, thread->m_threadIndex, thread->m_threadIndex);
+		separator = ",\n";
+		for (const SProfileEvent& event : thread->m_events)
+		{
+			fprintf(file, ",\n  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %zu, \"ts\": %0.3f, \"dur\": %0.3f}", m_zoneNames[event.m_zoneIndex],
+				thread->m_threadIndex, double(event.m_startNs) / 1000.0, double(event.m_durationNs) / 1000.0);
+		}
+		truncated |= thread->m_events.size() >= c_maxEventsPerThread;
+	}
+	fprintf(file, "\n], \"displayTimeUnit\": \"ms\", \"otherData\": {\"truncated\": %s}}\n", truncated ? "true" : "false");
+	return fclose(file) == 0;
+}
+
+#if PROFILE_LEVEL() > 0
+	#define PROFILE_CONCAT_INNER(a, b) a##b
+	#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+	#define PROFILE_SCOPE(name) \
+		static SProfileZone PROFILE_CONCAT(s_profileZone, __LINE__)(name); \
+		SProfileScope PROFILE_CONCAT(profileScope, __LINE__)(PROFILE_CONCAT(s_profileZone, __LINE__))
+	#define PROFILE_COUNT(counter, amount) (ProfileThread().m_counters[(size_t)EProfileCounter::counter] += (amount))
+#else
+	#define PROFILE_SCOPE(name)
+	#define PROFILE_COUNT(counter, amount)
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                      WAVE STORAGE
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const size_t c_cacheLineBytes = 64;
+static const size_t c_wordsPerCacheLine = c_cacheLineBytes / sizeof(uint64);
+
+inline size_t CountTrailingZeros (uint64 value)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return index;
+#else
+	return (size_t)__builtin_ctzll(value);
+#endif
+}
+
+// allocator that puts the start of the buffer on a cache line, so that every wave cell row is cache line (and SIMD register) aligned
+template <typename T>
+struct SAlignedAllocator
+{
+	typedef T value_type;
+
+	SAlignedAllocator () { }
+	template <typename U> SAlignedAllocator (const SAlignedAllocator<U>&) { }
+
+	T* allocate (size_t count)
+	{
+		void* memory = nullptr;
+	#if defined(_MSC_VER)
+		memory = _aligned_malloc(count * sizeof(T), c_cacheLineBytes);
+	#else
+		if (posix_memalign(&memory, c_cacheLineBytes, count * sizeof(T)) != 0)
+			memory = nullptr;
+	#endif
+		if (!memory)
+			throw std::bad_alloc();
+		return (T*)memory;
+	}
+
+	void deallocate (T* memory, size_t)
+	{
+	#if defined(_MSC_VER)
+		_aligned_free(memory);
+	#else
+		free(memory);
+	#endif
+	}
+
+	template <typename U> bool operator == (const SAlignedAllocator<U>&) const { return true; }
+	template <typename U> bool operator != (const SAlignedAllocator<U>&) const { return false; }
+};
+
+typedef std::vector<uint64, SAlignedAllocator<uint64>> TWaveWords;
+
+// The wave holds one bit per possibility for every cell.  Each cell gets its own row of 64 bit words, padded out to a whole number of
+// cache lines, so the kernels below never have to deal with a partial SIMD register and cells never share a cache line.
+struct SWave
+{
+	SWave ()
+		: m_numCells(0)
+		, m_bitsPerCell(0)
+		, m_wordsPerCell(0)
+	{ }
+
+	void Init (size_t numCells, size_t bitsPerCell)
+	{
+		m_numCells = numCells;
+		m_bitsPerCell = bitsPerCell;
+		m_wordsPerCell = WordsPerCell(bitsPerCell);
+
+		// every possibility starts out possible, but the padding bits stay zero so they never count as a possibility
+		m_words.assign(m_numCells * m_wordsPerCell, 0);
+		for (size_t cell = 0; cell < m_numCells; ++cell)
+			SetAllBits(Cell(cell));
+	}
+
+	static size_t WordsPerCell (size_t bitsPerCell)
+	{
+		size_t words = (bitsPerCell + 63) / 64;
+		return ((words + c_wordsPerCacheLine - 1) / c_wordsPerCacheLine) * c_wordsPerCacheLine;
+	}
+
+	void SetAllBits (uint64* cell) const
+	{
+		for (size_t bit = 0; bit < m_bitsPerCell; bit += 64)
+		{
+			size_t remaining = m_bitsPerCell - bit;
+			cell[bit / 64] = remaining >= 64 ? (uint64)-1 : ((uint64)1 << remaining) - 1;
+		}
+	}
+
+	uint64* Cell (size_t cell) { return &m_words[cell * m_wordsPerCell]; }
+	const uint64* Cell (size_t cell) const { return &m_words[cell * m_wordsPerCell]; }
+
+	bool Get (size_t cell, size_t bit) const
+	{
+		return ((Cell(cell)[bit / 64] >> (bit % 64)) & 1) != 0;
+	}
+
+	size_t		m_numCells;
+	size_t		m_bitsPerCell;
+	size_t		m_wordsPerCell;
+	TWaveWords	m_words;
+};
+
+// cell &= mask.  Returns true if any bit was cleared.
+inline bool WaveAndMask (uint64* cell, const uint64* mask, size_t numWords)
+{
+#if WAVE_SIMD_AVX2
+	__m256i changed = _mm256_setzero_si256();
+	for (size_t i = 0; i < numWords; i += 4)
+	{
+		__m256i before = _mm256_load_si256((const __m256i*)&cell[i]);
+		__m256i after = _mm256_and_si256(before, _mm256_load_si256((const __m256i*)&mask[i]));
+		changed = _mm256_or_si256(changed, _mm256_xor_si256(before, after));
+		_mm256_store_si256((__m256i*)&cell[i], after);
+	}
+	return !_mm256_testz_si256(changed, changed);
+#elif WAVE_SIMD_NEON
+	uint64x2_t changed = vdupq_n_u64(0);
+	for (size_t i = 0; i < numWords; i += 2)
+	{
+		uint64x2_t before = vld1q_u64(&cell[i]);
+		uint64x2_t after = vandq_u64(before, vld1q_u64(&mask[i]));
+		changed = vorrq_u64(changed, veorq_u64(before, after));
+		vst1q_u64(&cell[i], after);
+	}
+	return (vgetq_lane_u64(changed, 0) | vgetq_lane_u64(changed, 1)) != 0;
+#else
+	uint64 changed = 0;
+	for (size_t i = 0; i < numWords; ++i)
+	{
+		uint64 after = cell[i] & mask[i];
+		changed |= cell[i] ^ after;
+		cell[i] = after;
+	}
+	return changed != 0;
+#endif
+}
+
+// cell |= mask
+inline void WaveOrMask (uint64* cell, const uint64* mask, size_t numWords)
+{
+#if WAVE_SIMD_AVX2
+	for (size_t i = 0; i < numWords; i += 4)
+		_mm256_store_si256((__m256i*)&cell[i], _mm256_or_si256(_mm256_load_si256((const __m256i*)&cell[i]), _mm256_load_si256((const __m256i*)&mask[i])));
+#elif WAVE_SIMD_NEON
+	for (size_t i = 0; i < numWords; i += 2)
+		vst1q_u64(&cell[i], vorrq_u64(vld1q_u64(&cell[i]), vld1q_u64(&mask[i])));
+#else
+	for (size_t i = 0; i < numWords; ++i)
+		cell[i] |= mask[i];
+#endif
+}
+
+inline bool WaveAnyBitSet (const uint64* cell, size_t numWords)
+{
+#if WAVE_SIMD_AVX2
+	__m256i any = _mm256_setzero_si256();
+	for (size_t i = 0; i < numWords; i += 4)
+		any = _mm256_or_si256(any, _mm256_load_si256((const __m256i*)&cell[i]));
+	return !_mm256_testz_si256(any, any);
+#elif WAVE_SIMD_NEON
+	uint64x2_t any = vdupq_n_u64(0);
+	for (size_t i = 0; i < numWords; i += 2)
+		any = vorrq_u64(any, vld1q_u64(&cell[i]));
+	return (vgetq_lane_u64(any, 0) | vgetq_lane_u64(any, 1)) != 0;
+#else
+	uint64 any = 0;
+	for (size_t i = 0; i < numWords; ++i)
+		any |= cell[i];
+	return any != 0;
+#endif
+}
+
+// Sum of weights[bit] for every set bit in the cell.  weights has one entry per bit, including the padding bits.
+inline uint64 WaveWeightedPopCount (const uint64* cell, const uint64* weights, size_t numWords)
+{
+#if WAVE_SIMD_AVX2
+	// spread each word out four bits at a time into 64 bit lane masks, and add the weights that are under the mask
+	__m256i sum = _mm256_setzero_si256();
+	for (size_t i = 0; i < numWords; ++i)
+	{
+		if (!cell[i])
+			continue;
+		__m256i word = _mm256_set1_epi64x((long long)cell[i]);
+		__m256i select = _mm256_setr_epi64x(1, 2, 4, 8);
+		const uint64* wordWeights = &weights[i * 64];
+		for (size_t bit = 0; bit < 64; bit += 4)
+		{
+			__m256i laneMask = _mm256_cmpeq_epi64(_mm256_and_si256(word, select), select);
+			sum = _mm256_add_epi64(sum, _mm256_and_si256(laneMask, _mm256_load_si256((const __m256i*)&wordWeights[bit])));
+			select = _mm256_slli_epi64(select, 4);
+		}
+	}
+	uint64 lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, sum);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif WAVE_SIMD_NEON
+	uint64x2_t sum = vdupq_n_u64(0);
+	for (size_t i = 0; i < numWords; ++i)
+	{
+		if (!cell[i])
+			continue;
+		uint64x2_t word = vdupq_n_u64(cell[i]);
+		uint64x2_t select = vcombine_u64(vcreate_u64(1), vcreate_u64(2));
+		const uint64* wordWeights = &weights[i * 64];
+		for (size_t bit = 0; bit < 64; bit += 2)
+		{
+			uint64x2_t laneMask = vtstq_u64(word, select);
+			sum = vaddq_u64(sum, vandq_u64(laneMask, vld1q_u64(&wordWeights[bit])));
+			select = vshlq_n_u64(select, 2);
+		}
+	}
+	return vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+#else
+	uint64 sum = 0;
+	for (size_t i = 0; i < numWords; ++i)
+	{
+		uint64 word = cell[i];
+		while (word)
+		{
+			sum += weights[i * 64 + CountTrailingZeros(word)];
+			word &= word - 1;
+		}
+	}
+	return sum;
+#endif
+}
+
+// The parallel propagation engine shares the wave between threads, so it reads and clears wave words through this
+inline std::atomic<uint64>& WaveAtomicWord (uint64* word)
+{
+	static_assert(sizeof(std::atomic<uint64>) == sizeof(uint64), "wave words need to be usable as atomics");
+	return *(std::atomic<uint64>*)word;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                        ENTROPY
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum class EEntropyHeuristic
+{
+	e_minCount,		// the cell with the smallest total pattern count left is the most certain
+	e_shannon		// the cell with the smallest shannon entropy of its pattern counts is the most certain
+};
+
+// w*log(w) is kept in fixed point with this many fraction bits.  Integer totals come out the same whatever order the bans happen in,
+// so every propagation engine and thread count observes the same cells with the shannon heuristic.
+static const int c_weightLogWeightFractionBits = 20;
+
+inline uint64 WeightLogWeight (uint64 weight)
+{
+	if (weight <= 1)
+		return 0;
+	return (uint64)llround((double)weight * log((double)weight) * (double)((uint64)1 << c_weightLogWeightFractionBits));
+}
+
+// Running totals for the possibilities left in a cell, updated as possibilities are banned, so entropy never needs a full recount
+struct SCellEntropy
+{
+	uint64	m_sumWeights;
+	uint64	m_sumWeightLogWeights;	// fixed point, see WeightLogWeight()
+	size_t	m_remaining;
+};
+
+inline double CellEntropyKey (const SCellEntropy& cell, EEntropyHeuristic heuristic)
+{
+	// a cell with nothing left is a contradiction, so make it come out on top of the heap where Observe() will see it
+	if (cell.m_remaining == 0)
+		return -std::numeric_limits<double>::infinity();
+
+	if (heuristic == EEntropyHeuristic::e_minCount)
+		return (double)cell.m_sumWeights;
+
+	// H = -sum(p*log(p)) where p = w/W, which works out to log(W) - sum(w*log(w))/W
+	double sumWeights = (double)cell.m_sumWeights;
+	double sumWeightLogWeights = (double)cell.m_sumWeightLogWeights / (double)((uint64)1 << c_weightLogWeightFractionBits);
+	return log(sumWeights) - sumWeightLogWeights / sumWeights;
+}
+
+// Indexed binary min heap of undecided cells, keyed by entropy. Ties go to the lowest cell index, so results match a scanline search.
+struct SEntropyHeap
+{
+	static const size_t c_notInHeap = (size_t)-1;
+
+	void Init (size_t numCells, double key)
+	{
+		// every cell has the same key, so cell order is already a valid heap
+		m_keys.assign(numCells, key);
+		m_heap.resize(numCells);
+		m_heapIndex.resize(numCells);
+		for (size_t cell = 0; cell < numCells; ++cell)
+		{
+			m_heap[cell] = cell;
+			m_heapIndex[cell] = cell;
+		}
+	}
+
+	bool Empty () const { return m_heap.empty(); }
+	size_t Size () const { return m_heap.size(); }
+	size_t Top () const { return m_heap[0]; }
+	bool Contains (size_t cell) const { return m_heapIndex[cell] != c_notInHeap; }
+
+	void Push (size_t cell, double key)
+	{
+		m_keys[cell] = key;
+		m_heapIndex[cell] = m_heap.size();
+		m_heap.push_back(cell);
+		SiftUp(m_heap.size() - 1);
+	}
+
+	void Update (size_t cell, double key)
+	{
+		size_t index = m_heapIndex[cell];
+		if (index == c_notInHeap)
+			return;
+		double oldKey = m_keys[cell];
+		m_keys[cell] = key;
+		if (key < oldKey)
+			SiftUp(index);
+		else
+			SiftDown(index);
+	}
+
+	void Remove (size_t cell)
+	{
+		size_t index = m_heapIndex[cell];
+		if (index == c_notInHeap)
+			return;
+		size_t last = m_heap.size() - 1;
+		if (index != last)
+		{
+			Swap(index, last);
+			m_heap.pop_back();
+			m_heapIndex[cell] = c_notInHeap;
+			SiftUp(index);
+			SiftDown(index);
+		}
+		else
+		{
+			m_heap.pop_back();
+			m_heapIndex[cell] = c_notInHeap;
+		}
+	}
+
+private:
+	bool Less (size_t cellA, size_t cellB) const
+	{
+		return m_keys[cellA] < m_keys[cellB] || (m_keys[cellA] == m_keys[cellB] && cellA < cellB);
+	}
+
+	void Swap (size_t indexA, size_t indexB)
+	{
+		std::swap(m_heap[indexA], m_heap[indexB]);
+		m_heapIndex[m_heap[indexA]] = indexA;
+		m_heapIndex[m_heap[indexB]] = indexB;
+	}
+
+	void SiftUp (size_t index)
+	{
+		while (index > 0)
+		{
+			size_t parent = (index - 1) / 2;
+			if (!Less(m_heap[index], m_heap[parent]))
+				break;
+			Swap(index, parent);
+			index = parent;
+		}
+	}
+
+	void SiftDown (size_t index)
+	{
+		while (1)
+		{
+			size_t smallest = index;
+			size_t left = index * 2 + 1;
+			size_t right = left + 1;
+			if (left < m_heap.size() && Less(m_heap[left], m_heap[smallest]))
+				smallest = left;
+			if (right < m_heap.size() && Less(m_heap[right], m_heap[smallest]))
+				smallest = right;
+			if (smallest == index)
+				break;
+			Swap(index, smallest);
+			index = smallest;
+		}
+	}
+
+	std::vector<size_t>	m_heap;			// cells, in heap order
+	std::vector<size_t>	m_heapIndex;	// where each cell is in m_heap, or c_notInHeap
+	std::vector<double>	m_keys;			// the entropy of each cell
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                   PROPAGATION QUEUE
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct SPropagationEntry
+{
+	size_t	m_pixelIndex;
+	size_t	m_possibility;		// a possibility that was banned in this pixel
+	bool	m_emptiedPosition;	// true if that was the last possibility left at it's pattern position
+};
+
+// Stack of pixels that had possibilities banned and still need their changes propagated to their neighbors.
+// When m_dedupPixels is set, a pixel is only in the stack once at a time (m_queued), for propagation engines that look at everything a
+// pixel has left, not just the most recent ban.  Otherwise every ban gets it's own entry.
+struct SPropagationQueue
+{
+	SPropagationQueue ()
+		: m_dedupPixels(true)
+		, m_pushes(0)
+		, m_pops(0)
+		, m_maxDepth(0)
+		, m_seconds(0.0)
+	{ }
+
+	void Init (size_t numPixels, bool dedupPixels)
+	{
+		m_dedupPixels = dedupPixels;
+		m_entries.clear();
+		m_queued.assign(numPixels, 0);
+	}
+
+	void Clear ()
+	{
+		for (const SPropagationEntry& entry : m_entries)
+			m_queued[entry.m_pixelIndex] = 0;
+		m_entries.clear();
+	}
+
+	bool Empty () const { return m_entries.empty(); }
+	size_t Depth () const { return m_entries.size(); }
+
+	void Push (size_t pixelIndex, size_t possibility, bool emptiedPosition)
+	{
+		if (m_dedupPixels)
+		{
+			if (m_queued[pixelIndex])
+				return;
+			m_queued[pixelIndex] = 1;
+		}
+		m_entries.push_back({ pixelIndex, possibility, emptiedPosition });
+		++m_pushes;
+		m_maxDepth = std::max(m_maxDepth, m_entries.size());
+	}
+
+	SPropagationEntry Pop ()
+	{
+		SPropagationEntry entry = m_entries.back();
+		m_entries.pop_back();
+		m_queued[entry.m_pixelIndex] = 0;
+		++m_pops;
+		PROFILE_COUNT(e_queuePops, 1);
+		return entry;
+	}
+
+	bool							m_dedupPixels;
+	std::vector<SPropagationEntry>	m_entries;
+	std::vector<uint8>				m_queued;
+
+	// stats
+	uint64	m_pushes;
+	uint64	m_pops;
+	size_t	m_maxDepth;
+	double	m_seconds;	// time spent in PropagateAllChanges()
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                      BACKTRACKING
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// While backtracking is on, every change made after an observation (a decision) is logged, so that when a contradiction is found the
+// solver can go back to before the decision and ban what was chosen, instead of failing the whole run.
+
+struct SUndoBan
+{
+	uint32	m_pixelIndex;
+	uint32	m_possibility;
+};
+
+struct SUndoCellEntropy
+{
+	size_t			m_pixelIndex;
+	SCellEntropy	m_cellEntropy;	// what the cell's totals were before the first change since the last decision
+};
+
+struct SDecision
+{
+	size_t	m_pixelIndex;
+	size_t	m_possibility;		// what the pixel was observed to be
+	size_t	m_bansMark;			// how long each undo log was when the decision was made
+	size_t	m_propagatedMark;
+	size_t	m_cellEntropiesMark;
+};
+
+struct SUndoLog
+{
+	SUndoLog ()
+		: m_maxDepth(0)
+		, m_maxBytes(256 * 1024 * 1024)
+		, m_maxBacktracks(100000)
+		, m_backjump(1)
+		, m_epoch(0)
+		, m_backtracks(0)
+		, m_restoredBytes(0)
+		, m_maxBytesUsed(0)
+		, m_commits(0)
+	{ }
+
+	void Init (size_t numPixels)
+	{
+		m_decisions.clear();
+		m_bans.clear();
+		m_propagated.clear();
+		m_cellEntropies.clear();
+		m_cellEntropyEpoch.assign(numPixels, 0);
+		m_epoch = 1;
+	}
+
+	bool Enabled () const { return m_maxDepth > 0; }
+
+	// changes only need logging if there is a decision to undo them back to
+	bool Recording () const { return !m_decisions.empty(); }
+
+	size_t Bytes () const
+	{
+		return m_decisions.size() * sizeof(SDecision) + m_bans.size() * sizeof(SUndoBan) + m_propagated.size() * sizeof(SPropagationEntry) +
+			m_cellEntropies.size() * sizeof(SUndoCellEntropy);
+	}
+
+	// Makes the oldest count decisions permanent, to stay inside the budget
+	void Commit (size_t count)
+	{
+		const size_t bansMark = count < m_decisions.size() ? m_decisions[count].m_bansMark : m_bans.size();
+		const size_t propagatedMark = count < m_decisions.size() ? m_decisions[count].m_propagatedMark : m_propagated.size();
+		const size_t cellEntropiesMark = count < m_decisions.size() ? m_decisions[count].m_cellEntropiesMark : m_cellEntropies.size();
+		m_bans.erase(m_bans.begin(), m_bans.begin() + bansMark);
+		m_propagated.erase(m_propagated.begin(), m_propagated.begin() + propagatedMark);
+		m_cellEntropies.erase(m_cellEntropies.begin(), m_cellEntropies.begin() + cellEntropiesMark);
+		m_decisions.erase(m_decisions.begin(), m_decisions.begin() + count);
+		for (SDecision& decision : m_decisions)
+		{
+			decision.m_bansMark -= bansMark;
+			decision.m_propagatedMark -= propagatedMark;
+			decision.m_cellEntropiesMark -= cellEntropiesMark;
+		}
+		++m_commits;
+	}
+
+	// settings
+	size_t	m_maxDepth;			// how many decisions can be undone.  0 turns backtracking off
+	size_t	m_maxBytes;			// how big the undo logs can get before old decisions are made permanent
+	uint64	m_maxBacktracks;	// give up after this many
+	size_t	m_backjump;			// how many decisions to undo on a contradiction
+
+	std::vector<SDecision>			m_decisions;
+	std::vector<SUndoBan>			m_bans;
+	std::vector<SPropagationEntry>	m_propagated;		// bans the support counter engine propagated, which took supports away
+	std::vector<SUndoCellEntropy>	m_cellEntropies;
+	std::vector<uint32>				m_cellEntropyEpoch;	// [pixel] m_epoch when the cell's totals were last logged
+	uint32							m_epoch;			// changes whenever a decision is made or undone
+
+	// stats
+	uint64	m_backtracks;
+	uint64	m_restoredBytes;
+	size_t	m_maxBytesUsed;
+	uint64	m_commits;
+};
+
+// The parallel propagation engine splits the output into bands of rows, each owned by a worker thread.  A worker re-checks the
+// neighbors of the pixels in it's stack and clears bits in the wave with atomic ANDs, even when the neighbor belongs to another worker,
+// then pushes every pixel it changed onto the stack of that pixel's owner.  Propagation is finished when no pixel is pending anywhere.
+// Since a ban only ever makes other bans possible, the order the workers run in doesn't change where they end up.
+
+// Bits a worker cleared in a wave word.  The entropy totals and heap aren't thread safe, so these get applied after the workers finish.
+struct SParallelBan
+{
+	uint32	m_pixelIndex;
+	uint32	m_wordIndex;
+	uint64	m_bits;
+
+	bool operator < (const SParallelBan& other) const
+	{
+		if (m_pixelIndex != other.m_pixelIndex)
+			return m_pixelIndex < other.m_pixelIndex;
+		return m_wordIndex != other.m_wordIndex ? m_wordIndex < other.m_wordIndex : m_bits < other.m_bits;
+	}
+};
+
+struct SPropagationWorker
+{
+	std::atomic<uint32>			m_head;			// top of this worker's lock free stack of pixels, linked through SParallelPropagation::m_next
+	uint8						m_padding[c_cacheLineBytes - sizeof(std::atomic<uint32>)];
+
+	std::vector<uint32>			m_pixels;		// the pixels most recently taken off the stack
+	TWaveWords					m_changedCell;	// copy of the changed cell, since other workers can be changing it
+	std::vector<uint8>			m_changedPixelPositions;
+	std::vector<SParallelBan>	m_bans;
+	uint64						m_pops;
+};
+
+struct SParallelPropagation
+{
+	static const uint32 c_none = (uint32)-1;
+
+	void Init (size_t width, size_t height, size_t numThreads, size_t wordsPerCell, size_t positionCount)
+	{
+		m_width = width;
+		m_height = height;
+		m_queued = std::vector<std::atomic<uint8>>(width * height);
+		for (std::atomic<uint8>& queued : m_queued)
+			queued.store(0, std::memory_order_relaxed);
+		m_next.assign(width * height, c_none);
+		m_pending.store(0, std::memory_order_relaxed);
+
+		m_workers = std::vector<SPropagationWorker>(std::max<size_t>(1, std::min(numThreads, height)));
+		for (SPropagationWorker& worker : m_workers)
+		{
+			worker.m_head.store(c_none, std::memory_order_relaxed);
+			worker.m_changedCell.resize(wordsPerCell);
+			worker.m_changedPixelPositions.resize(positionCount);
+			worker.m_pops = 0;
+		}
+		m_pool.Start(m_workers.size());
+	}
+
+	size_t Owner (size_t pixelIndex) const { return (pixelIndex / m_width) * m_workers.size() / m_height; }
+
+	// Called from any thread.  Does nothing if the pixel is already waiting to be propagated.
+	void Push (size_t pixelIndex)
+	{
+		if (m_queued[pixelIndex].exchange(1, std::memory_order_acq_rel))
+			return;
+
+		// count it as pending before the owner can possibly see it, so m_pending can't hit zero while it's still in a stack
+		m_pending.fetch_add(1, std::memory_order_acq_rel);
+		std::atomic<uint32>& head = m_workers[Owner(pixelIndex)].m_head;
+		uint32 next = head.load(std::memory_order_relaxed);
+		do
+		{
+			m_next[pixelIndex] = next;
+		}
+		while (!head.compare_exchange_weak(next, (uint32)pixelIndex, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	// Called only by the owning worker.  Takes the whole stack at once, so there is no ABA problem with nodes being pushed again.
+	bool TakeAll (SPropagationWorker& worker)
+	{
+		worker.m_pixels.clear();
+		uint32 pixelIndex = worker.m_head.exchange(c_none, std::memory_order_acquire);
+		for (; pixelIndex != c_none; pixelIndex = m_next[pixelIndex])
+			worker.m_pixels.push_back(pixelIndex);
+		return !worker.m_pixels.empty();
+	}
+
+	size_t								m_width;
+	size_t								m_height;
+	std::vector<std::atomic<uint8>>		m_queued;	// [pixel] in some worker's stack
+	std::vector<uint32>					m_next;		// [pixel] next pixel in the same stack
+	std::atomic<size_t>					m_pending;	// pixels pushed and not yet finished propagating
+	SWorkerPool							m_pool;		// a thread for each worker, parked between propagations
+	std::vector<SPropagationWorker>		m_workers;
+	std::vector<SParallelBan>			m_bans;		// every worker's bans, once they are done
+};
+
+const uint32 SParallelPropagation::c_none;
+
+enum class EPropagationEngine
+{
+	e_compatibilityTable,			// when a pixel changes, re-check every possibility of every neighbor against the propagator
+	e_supportCounters,				// AC-4: count the supports each possibility has from each neighbor, and ban it when a count hits zero
+	e_parallelCompatibilityTable,	// e_compatibilityTable, spread across m_numThreads threads
+	e_tileAdjacency					// the simple tiled model's engine: AND each neighbor with the tiles the pixel's tiles allow next to it
+};
+
+// What a pixel's possibilities are.  Either way a possibility is a pattern anchored at pixel - position, and patterns are compatible
+// when they agree where they overlap, so everything below works in terms of positions and only the number of them changes.
+enum class EDomain
+{
+	e_patternPosition,	// which pattern covers the pixel, and at which of the N*N positions inside it.  patterns * N^2 bits per pixel
+	e_patternAnchored	// which pattern has it's top left corner at the pixel.  patterns bits per pixel, the usual overlapped model
+};
+
+enum class EModelType
+{
+	e_overlapping,	// patterns are every N x N window of the source image, and agree with each other where they overlap
+	e_simpleTiled	// patterns are the tiles of a tileset, each one covers one output pixel, and adjacency rules say what can be next to what
+};
+
+// The simple tiled model's neighbors, in the order STileAdjacency stores them.  Each direction's opposite is it's index ^ 1.  Rows go
+// bottom to top, like BMP rows, so +y is up.
+static const size_t c_numTileDirections = 4;
+static const int c_tileDirectionOffsets[c_numTileDirections][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };	// left, right, down, up
+static const size_t c_tileDirectionRight = 1;
+static const size_t c_tileDirectionUp = 3;
+
+// Which tiles can be next to each tile in each direction, as a bitset laid out like a wave cell.  A pixel's neighbor in a direction can
+// keep the tiles in the OR of the bitsets of the tiles the pixel has left, so propagating is an OR per tile and an AND per neighbor.
+struct STileAdjacency
+{
+	STileAdjacency ()
+		: m_numTiles(0)
+		, m_wordsPerTile(0)
+	{ }
+
+	void Init (size_t numTiles)
+	{
+		m_numTiles = numTiles;
+		m_wordsPerTile = SWave::WordsPerCell(numTiles);
+		m_allowed.assign(c_numTileDirections * numTiles * m_wordsPerTile, 0);
+	}
+
+	// neighbor can be next to tile in direction, so tile can also be next to neighbor in the opposite direction
+	void Allow (size_t direction, size_t tile, size_t neighbor)
+	{
+		Allowed(direction, tile)[neighbor / 64] |= (uint64)1 << (neighbor % 64);
+		Allowed(direction ^ 1, neighbor)[tile / 64] |= (uint64)1 << (tile % 64);
+	}
+
+	uint64* Allowed (size_t direction, size_t tile) { return &m_allowed[(direction * m_numTiles + tile) * m_wordsPerTile]; }
+	const uint64* Allowed (size_t direction, size_t tile) const { return &m_allowed[(direction * m_numTiles + tile) * m_wordsPerTile]; }
+
+	size_t		m_numTiles;
+	size_t		m_wordsPerTile;
+	TWaveWords	m_allowed;	// [direction][tile][word]
+};
+
+// A possibility is supported from a neighbor by the neighbor's possibilities whose patterns overlap it and agree with it, and also by
+// any neighbor possibility whose pattern doesn't overlap it at all.  The overlapping ones are counted per possibility.  The
+// non-overlapping ones only depend on the position within the pattern, so instead we count how many of those positions the neighbor
+// still has any pattern at, and how many patterns each pixel has left at each position.
+
+// Everything that comes from the source image and doesn't change while solving.  Any number of SContexts can solve with one model.
+struct SModel
+{
+	SModel()
+		: m_type(EModelType::e_overlapping)
+		, m_numThreads(GetDefaultThreadCount())
+		, m_domain(EDomain::e_patternPosition)
+		, m_useCacheFile(false)
+		, m_loadedFromCache(false)
+		, m_specializeKernels(true)
+	{ }
+
+	SImageData				m_colorImage;
+	SPalletizedImageData	m_palletizedImage;
+
+	SPatternTable			m_patterns;
+
+	EModelType	m_type;
+	size_t		m_tileSize;			// N, or the tileset's tile size for the simple tiled model
+	std::string	m_fileName;
+	std::string	m_rulesFileName;	// simple tiled model adjacency rules, see LoadTileRules().  Without them, tiles with matching edges can touch.
+	bool		m_periodicInput;
+	uint8		m_symmetry;
+	size_t		m_numThreads;		// how many threads the parallel stages can use
+
+	EDomain		m_domain;
+	size_t		m_positionsPerAxis;	// positions inside a pattern that a pixel can be at, per axis: N, or 1 when anchored
+	size_t		m_boolsPerPixel;
+
+	SPropagator		m_propagator;
+	STileAdjacency	m_tileAdjacency;
+
+	bool		m_useCacheFile;		// load the built model from a cache file next to the image, and save it there if it isn't
+	bool		m_loadedFromCache;
+	bool		m_specializeKernels;	// use the kernels compiled for this tile size if there are any, see DispatchTileSize()
+
+	// how long each stage of BuildModel() took.  Loading from the cache file counts as loading.
+	double		m_loadSeconds;
+	double		m_palletizeSeconds;
+	double		m_patternsSeconds;
+	double		m_propagatorSeconds;
+};
+
+// Kernels that are templated on TILE have the tile size as a compile time constant, so their loops have fixed trip counts that the
+// compiler can unroll, and the index math folds into constants.  TILE 0 is the generic version, which uses the runtime tile size.
+// Only gathering the patterns and building the propagator are specialized.  Propagation was measured no faster specialized.
+template <size_t TILE>
+inline size_t TileSize (size_t tileSize)
+{
+	return TILE > 0 ? TILE : tileSize;
+}
+
+// Calls f(std::integral_constant<size_t, TILE>()) with TILE = the model's tile size if it's one of the tile sizes that get their own
+// kernels, otherwise with TILE = 0 for the generic kernels.
+template <typename LAMBDA>
+void DispatchTileSize (const SModel& model, LAMBDA&& f)
+{
+	switch (model.m_specializeKernels ? model.m_tileSize : 0)
+	{
+		case 2: f(std::integral_constant<size_t, 2>()); break;
+		case 3: f(std::integral_constant<size_t, 3>()); break;
+		case 4: f(std::integral_constant<size_t, 4>()); break;
+		case 5: f(std::integral_constant<size_t, 5>()); break;
+		default: f(std::integral_constant<size_t, 0>()); break;
+	}
+}
+
+struct SImageStreamWriter;
+struct SInitialState;
+
+// The state of one solve
+struct SContext
+{
+	SContext(const SModel& model, uint32 prngSeed = -1)
+		: m_model(model)
+		, m_palletizedImage(model.m_palletizedImage)
+		, m_patterns(model.m_patterns)
+		, m_propagator(model.m_propagator)
+		, m_tileSize(model.m_tileSize)
+		, m_positionsPerAxis(model.m_positionsPerAxis)
+		, m_boolsPerPixel(model.m_boolsPerPixel)
+		, m_prng(prngSeed)
+		, m_propagationEngine(EPropagationEngine::e_supportCounters)
+		, m_entropyHeuristic(EEntropyHeuristic::e_minCount)
+		, m_initialState(nullptr)
+		, m_streamWriter(nullptr)
+		, m_numThreads(model.m_numThreads)
+		, m_initializeSeconds(0.0)
+		, m_observeSeconds(0.0)
+	{ }
+
+	// shortcuts into the model
+	const SModel&							m_model;
+	const SPalletizedImageData&				m_palletizedImage;
+	const SPatternTable&					m_patterns;
+	const SPropagator&						m_propagator;
+	const size_t							m_tileSize;
+	const size_t							m_positionsPerAxis;
+	const size_t							m_boolsPerPixel;
+
+	SPRNG		m_prng;
+
+	SPropagationQueue		m_propagationQueue;
+	SParallelPropagation	m_parallelPropagation;
+	SUndoLog				m_undoLog;
+
+	EPropagationEngine		m_propagationEngine;
+	size_t					m_numNeighborOffsets;		// (2N-1)^2 - 1 neighbors can be affected by a pixel
+	std::vector<uint32>		m_initialSupportCounts;		// [neighborOffset][possibility]
+	std::vector<uint32>		m_supportCounts;			// [pixel][neighborOffset][possibility] overlapping supports
+	std::vector<uint32>		m_initialPositionSupportCounts;	// [neighborOffset][position]
+	std::vector<uint32>		m_positionSupportCounts;	// [pixel][neighborOffset][position] non-overlapping positions with patterns left
+	std::vector<uint32>		m_positionCounts;			// [pixel][position] how many patterns are left at each position
+
+	SWave					m_wave;
+	TWaveWords				m_possibilityWeights;	// the pattern count for each bit in a wave cell
+	std::vector<uint64>		m_possibilityWeightLogWeights;	// WeightLogWeight() of each bit's weight
+
+	EEntropyHeuristic			m_entropyHeuristic;
+	std::vector<SCellEntropy>	m_cellEntropy;
+	SEntropyHeap				m_entropyHeap;
+	TWaveWords				m_scratchMask;
+	std::vector<uint8>		m_changedPixelPositions;
+
+	SObservedPixels				m_observedPixels;
+	std::vector<SPinnedPixel>	m_pinnedPixels;
+	std::vector<SPinnedColor>	m_pinnedColors;
+
+	// When set, Run() starts from a copy of this instead of setting up the wave and propagating the pins, see SaveInitialState()
+	const SInitialState*		m_initialState;
+
+	// When set, each output row is queued to the writer as soon as every pixel in it is decided, and queued again if backtracking
+	// undoes and redecides any of it
+	SImageStreamWriter*			m_streamWriter;
+	std::vector<uint32>			m_rowUndecidedPixels;	// [row] how many pixels in the row are undecided
+	std::vector<SPixel>			m_streamRow;
+
+	bool		m_periodicOutput;
+	size_t		m_numThreads;		// how many threads parallel propagation can use
+	size_t		m_outputImageWidth;
+	size_t		m_outputImageHeight;
+	size_t		m_numPixels;
+
+	// how long Run() spent setting up the wave and observing.  Propagating is timed by the propagation queue.
+	double		m_initializeSeconds;
+	double		m_observeSeconds;
+};
+
+// Everything Run() sets up before the first observation, once the pins have been propagated as far as they go.  Solving the same pins
+// over and over with different seeds can make this once, and copy it into each solve instead of propagating the pins every time.
+struct SInitialState
+{
+	EPropagationEngine			m_propagationEngine;	// support counts only exist for e_supportCounters, so solves use this engine
+	size_t						m_outputImageWidth;
+	size_t						m_outputImageHeight;
+	bool						m_periodicOutput;
+	bool						m_pinned;				// false if a pinned pixel's possibility was gone, which fails every solve
+
+	SWave						m_wave;
+	TWaveWords					m_possibilityWeights;
+	std::vector<uint64>			m_possibilityWeightLogWeights;
+	std::vector<SCellEntropy>	m_cellEntropy;
+	SEntropyHeap				m_entropyHeap;
+	size_t						m_numNeighborOffsets;
+	std::vector<uint32>			m_supportCounts;
+	std::vector<uint32>			m_positionSupportCounts;
+	std::vector<uint32>			m_positionCounts;
+	SObservedPixels				m_observedPixels;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                               IMAGE LOADING AND SAVING
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Images are read as 8, 24 or 32 bit uncompressed BMPs, stored bottom up or top down, or as binary (P6) PPMs with 8 bit channels.
+// They are written as 24 bit bottom up BMPs, or as PPMs when the file name ends in .ppm.
+
+inline uint16 ReadLE16 (const uint8* bytes)
+{
+	return (uint16)(bytes[0] | (bytes[1] << 8));
+}
+
+inline uint32 ReadLE32 (const uint8* bytes)
+{
+	return (uint32)bytes[0] | ((uint32)bytes[1] << 8) | ((uint32)bytes[2] << 16) | ((uint32)bytes[3] << 24);
+}
+
+inline void WriteLE16 (uint8* bytes, uint16 value)
+{
+	bytes[0] = (uint8)value;
+	bytes[1] = (uint8)(value >> 8);
+}
+
+inline void WriteLE32 (uint8* bytes, uint32 value)
+{
+	for (size_t byteIndex = 0; byteIndex < 4; ++byteIndex)
+		bytes[byteIndex] = (uint8)(value >> (byteIndex * 8));
+}
+
+bool ParseBMP (const uint8* data, size_t size, SImageData& imageData)
+{
+	// file header, then at least a BITMAPINFOHEADER
+	if (size < 54 || data[0] != 'B' || data[1] != 'M')
+		return false;
+	const size_t pixelOffset = ReadLE32(&data[10]);
+	const size_t infoSize = ReadLE32(&data[14]);
+	const int32_t width = (int32_t)ReadLE32(&data[18]);
+	const int32_t height = (int32_t)ReadLE32(&data[22]);
+	const uint16 bitCount = ReadLE16(&data[28]);
+	const uint32 compression = ReadLE32(&data[30]);
+	if (infoSize < 40 || 14 + infoSize > size || width <= 0 || height == 0 || height == INT32_MIN)
+		return false;
+
+	// Uncompressed only.  32 bit images may say they're bitfields, as long as the fields are the usual BGRX ones.  The masks come
+	// right after a BITMAPINFOHEADER, or are part of the larger headers.
+	if (compression == 3)
+	{
+		if (bitCount != 32 || size < 66 || ReadLE32(&data[54]) != 0x00FF0000 || ReadLE32(&data[58]) != 0x0000FF00 || ReadLE32(&data[62]) != 0x000000FF)
+			return false;
+	}
+	else if (compression != 0)
+		return false;
+
+	imageData.m_colorTable.clear();
+	switch (bitCount)
+	{
+		case 8:
+		{
+			// the color table follows the headers, with 4 bytes per color.  Any index past the end of it is black.
+			size_t numColors = ReadLE32(&data[46]);
+			if (numColors == 0 || numColors > 256)
+				numColors = 256;
+			const size_t colorTableOffset = 14 + infoSize;
+			if (colorTableOffset + numColors * 4 > size)
+				return false;
+			imageData.m_colorTable.assign(256, SPixel{ 0, 0, 0 });
+			for (size_t colorIndex = 0; colorIndex < numColors; ++colorIndex)
+				imageData.m_colorTable[colorIndex] = *(const SPixel*)&data[colorTableOffset + colorIndex * 4];
+			imageData.m_format = EPixelFormat::e_indexed8;
+			break;
+		}
+		case 24: imageData.m_format = EPixelFormat::e_bgr24; break;
+		case 32: imageData.m_format = EPixelFormat::e_bgrx32; break;
+		default: return false;
+	}
+
+	// rows are padded to a multiple of 4 bytes.  A negative height means the top row is stored first.
+	const size_t numRows = height < 0 ? (size_t)-height : (size_t)height;
+	const size_t pitch = ((size_t)width * bitCount / 8 + 3) & ~(size_t)3;
+	if (pixelOffset > size || pitch * numRows > size - pixelOffset)
+		return false;
+	imageData.m_width = (size_t)width;
+	imageData.m_height = numRows;
+	imageData.m_rows = &data[pixelOffset];
+	imageData.m_rowStride = (ptrdiff_t)pitch;
+	if (height < 0)
+	{
+		imageData.m_rows += pitch * (numRows - 1);
+		imageData.m_rowStride = -(ptrdiff_t)pitch;
+	}
+	return true;
+}
+
+bool ParsePPM (const uint8* data, size_t size, SImageData& imageData)
+{
+	// "P6", then the width, height and max value as text, separated by whitespace and # comments, then one whitespace byte
+	if (size < 2 || data[0] != 'P' || data[1] != '6')
+		return false;
+	size_t offset = 2;
+	size_t fields[3];
+	for (size_t& field : fields)
+	{
+		while (offset < size && (isspace(data[offset]) || data[offset] == '#'))
+		{
+			if (data[offset] == '#')
+			{
+				while (offset < size && data[offset] != '\n')
+					++offset;
+			}
+			else
+				++offset;
+		}
+		if (offset >= size || !isdigit(data[offset]))
+			return false;
+		field = 0;
+		while (offset < size && isdigit(data[offset]) && field < 0x10000000)
+			field = field * 10 + (data[offset++] - '0');
+	}
+	if (offset >= size || !isspace(data[offset]) || fields[0] == 0 || fields[1] == 0 || fields[2] != 255)
+		return false;
+	++offset;
+
+	// rows are stored top first with no padding
+	const size_t pitch = fields[0] * 3;
+	if (pitch * fields[1] > size - offset)
+		return false;
+	imageData.m_colorTable.clear();
+	imageData.m_format = EPixelFormat::e_rgb24;
+	imageData.m_width = fields[0];
+	imageData.m_height = fields[1];
+	imageData.m_rows = &data[offset + pitch * (fields[1] - 1)];
+	imageData.m_rowStride = -(ptrdiff_t)pitch;
+	return true;
+}
+
+// Maps the file and makes imageData a view of it.  Nothing is copied, the pixels are converted as they are read.
+bool LoadImage (const char *fileName, SImageData& imageData)
+{
+	PROFILE_SCOPE("LoadImage");
+	std::unique_ptr<SMappedFile> file(new SMappedFile);
+	if (!file->Open(fileName))
+		return false;
+
+	const bool isPPM = file->m_size >= 2 && file->m_data[0] == 'P';
+	if (!(isPPM ? ParsePPM(file->m_data, file->m_size, imageData) : ParseBMP(file->m_data, file->m_size, imageData)))
+		return false;
+
+	imageData.m_pixels.clear();
+	imageData.m_mappedFile = std::move(file);
+	return true;
+}
+
+inline bool IsPPMFileName (const char* fileName)
+{
+	size_t length = strlen(fileName);
+	return length >= 4 && (!strcmp(&fileName[length - 4], ".ppm") || !strcmp(&fileName[length - 4], ".PPM"));
+}
+
+// Writes the 54 bytes of BITMAPFILEHEADER and BITMAPINFOHEADER for a 24 bit bottom up BMP
+void MakeBMPHeader (uint8* header, size_t width, size_t height)
+{
+	const size_t imageSize = ((width * 3 + 3) & ~(size_t)3) * height;
+	memset(header, 0, 54);
+	header[0] = 'B';
+	header[1] = 'M';
+	WriteLE32(&header[2], (uint32)(54 + imageSize));
+	WriteLE32(&header[10], 54);
+	WriteLE32(&header[14], 40);
+	WriteLE32(&header[18], (uint32)width);
+	WriteLE32(&header[22], (uint32)height);
+	WriteLE16(&header[26], 1);
+	WriteLE16(&header[28], 24);
+	WriteLE32(&header[34], (uint32)imageSize);
+}
+
+// Writes a binary PPM header, which is at most 64 bytes, and returns it's size
+size_t MakePPMHeader (uint8* header, size_t width, size_t height)
+{
+	return (size_t)snprintf((char*)header, 64, "P6\n%zu %zu\n255\n", width, height);
+}
+
+// Writes an image file in place, in a file that is created at it's final size and mapped.  Rows can be written in any order, and are
+// numbered like SImageData's, bottom row first.
+struct SImageFileWriter
+{
+	SImageFileWriter ()
+		: m_ppm(false)
+		, m_width(0)
+		, m_height(0)
+		, m_pitch(0)
+		, m_headerSize(0)
+	{ }
+
+	bool Open (const char* fileName, size_t width, size_t height)
+	{
+		m_ppm = IsPPMFileName(fileName);
+		m_width = width;
+		m_height = height;
+		// BMP rows are padded to a multiple of 4 bytes
+		uint8 header[64];
+		m_pitch = m_ppm ? width * 3 : (width * 3 + 3) & ~(size_t)3;
+		m_headerSize = m_ppm ? MakePPMHeader(header, width, height) : 54;
+		if (!m_ppm)
+			MakeBMPHeader(header, width, height);
+		if (!m_file.Create(fileName, m_headerSize + m_pitch * height))
+			return false;
+		memcpy(m_file.m_data, header, m_headerSize);
+		return true;
+	}
+
+	void WriteRow (size_t y, const SPixel* pixels)
+	{
+		if (!m_ppm)
+		{
+			memcpy(&m_file.m_data[m_headerSize + y * m_pitch], pixels, m_width * sizeof(SPixel));
+			return;
+		}
+
+		// PPMs are RGB, top row first
+		uint8* dest = &m_file.m_data[m_headerSize + (m_height - 1 - y) * m_pitch];
+		for (size_t x = 0; x < m_width; ++x, dest += 3)
+		{
+			dest[0] = pixels[x].R;
+			dest[1] = pixels[x].G;
+			dest[2] = pixels[x].B;
+		}
+	}
+
+	bool Close ()
+	{
+		return m_file.Close();
+	}
+
+	SMappedOutputFile	m_file;
+	bool				m_ppm;
+	size_t				m_width;
+	size_t				m_height;
+	size_t				m_pitch;
+	size_t				m_headerSize;
+};
+
+// Writes an image a row at a time while the rest of it is still being solved.  QueueRow() encodes the row on the calling thread and
+// hands it to a background I/O thread, which writes it straight to it's place in the file, so rows can come in any order and a row
+// queued again replaces what was written before.  The header is written last, by Close().  At most c_maxPendingRows rows wait at
+// once, after that QueueRow() waits for the I/O thread to catch up.
+struct SImageStreamWriter
+{
+	static const size_t c_maxPendingRows = 64;
+
+	SImageStreamWriter ()
+		: m_ppm(false)
+		, m_width(0)
+		, m_height(0)
+		, m_pitch(0)
+		, m_headerSize(0)
+		, m_closing(false)
+		, m_failed(false)
+		, m_rowsQueued(0)
+		, m_rowsWritten(0)
+		, m_writeSeconds(0.0)
+	{ }
+
+	~SImageStreamWriter ()
+	{
+		Close();
+	}
+
+	bool Open (const char* fileName, size_t width, size_t height)
+	{
+		if (!m_file.Create(fileName))
+			return false;
+		m_ppm = IsPPMFileName(fileName);
+		m_width = width;
+		m_height = height;
+		m_pitch = m_ppm ? width * 3 : (width * 3 + 3) & ~(size_t)3;
+		m_headerSize = m_ppm ? MakePPMHeader(m_header, width, height) : 54;
+		m_closing = false;
+		m_failed = false;
+		m_thread = std::thread([this] () { WriteRows(); });
+		return true;
+	}
+
+	void QueueRow (size_t y, const SPixel* pixels)
+	{
+		std::vector<uint8> row;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_roomCondition.wait(lock, [this] () { return m_pending.size() < c_maxPendingRows; });
+			if (!m_freeRows.empty())
+			{
+				row.swap(m_freeRows.back());
+				m_freeRows.pop_back();
+			}
+		}
+
+		// BMP rows are BGR like SPixel, bottom row first and padded.  PPM rows are RGB, top row first.
+		row.assign(m_pitch, 0);
+		if (!m_ppm)
+			memcpy(&row[0], pixels, m_width * sizeof(SPixel));
+		else
+		{
+			for (size_t x = 0; x < m_width; ++x)
+			{
+				row[x * 3 + 0] = pixels[x].R;
+				row[x * 3 + 1] = pixels[x].G;
+				row[x * 3 + 2] = pixels[x].B;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pending.push_back(std::make_pair(m_ppm ? m_height - 1 - y : y, std::move(row)));
+			++m_rowsQueued;
+		}
+		m_rowCondition.notify_one();
+	}
+
+	// waits for the queued rows to be written, writes the header and closes the file.  Returns false if anything couldn't be written.
+	bool Close ()
+	{
+		if (!m_thread.joinable())
+			return !m_failed;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_closing = true;
+		}
+		m_rowCondition.notify_one();
+		m_thread.join();
+
+		if (!m_ppm)
+			MakeBMPHeader(m_header, m_width, m_height);
+		bool success = !m_failed && m_file.WriteAt(0, m_header, m_headerSize);
+		success &= m_file.Close();
+		m_failed = !success;
+		return success;
+	}
+
+	// stats
+	uint64 RowsQueued () const { std::lock_guard<std::mutex> lock(m_mutex); return m_rowsQueued; }
+	uint64 RowsWritten () const { std::lock_guard<std::mutex> lock(m_mutex); return m_rowsWritten; }
+	double WriteSeconds () const { std::lock_guard<std::mutex> lock(m_mutex); return m_writeSeconds; }
+
+private:
+	void WriteRows ()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (1)
+		{
+			m_rowCondition.wait(lock, [this] () { return m_closing || !m_pending.empty(); });
+			if (m_pending.empty())
+				return;
+
+			std::pair<size_t, std::vector<uint8>> row = std::move(m_pending.front());
+			m_pending.pop_front();
+			lock.unlock();
+			m_roomCondition.notify_one();
+
+			TClock::time_point start = TClock::now();
+			bool written = m_file.WriteAt(m_headerSize + (uint64)row.first * m_pitch, &row.second[0], m_pitch);
+			double seconds = SecondsSince(start);
+
+			lock.lock();
+			m_failed |= !written;
+			++m_rowsWritten;
+			m_writeSeconds += seconds;
+			m_freeRows.push_back(std::move(row.second));
+		}
+	}
+
+	SOutputFile			m_file;
+	bool				m_ppm;
+	size_t				m_width;
+	size_t				m_height;
+	size_t				m_pitch;
+	size_t				m_headerSize;
+	uint8				m_header[64];
+
+	std::thread									m_thread;
+	mutable std::mutex							m_mutex;
+	std::condition_variable						m_rowCondition;		// a row was queued, or we're closing
+	std::condition_variable						m_roomCondition;	// a row was taken off the queue
+	std::deque<std::pair<size_t, std::vector<uint8>>>	m_pending;	// file row index and encoded row
+	std::vector<std::vector<uint8>>				m_freeRows;
+	bool										m_closing;
+	bool										m_failed;
+
+	uint64				m_rowsQueued;
+	uint64				m_rowsWritten;
+	double				m_writeSeconds;
+};
+
+bool SaveImage (const char *fileName, const SImageData &image)
+{
+	PROFILE_SCOPE("SaveImage");
+	SImageFileWriter writer;
+	if (!writer.Open(fileName, image.m_width, image.m_height))
+		return false;
+
+	// allocated images can be written as they are, anything else is converted a row at a time
+	std::vector<SPixel> row(image.m_width);
+	for (size_t y = 0; y < image.m_height; ++y)
+	{
+		if (image.m_format == EPixelFormat::e_bgr24)
+		{
+			writer.WriteRow(y, (const SPixel*)image.Row(y));
+			continue;
+		}
+		image.ForEachPixelInRow(y, [&row] (size_t x, const SPixel& pixel) { row[x] = pixel; });
+		writer.WriteRow(y, &row[0]);
+	}
+	return writer.Close();
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                IMAGE PALLETIZATION
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+inline uint32 PackColor (const SPixel& pixel)
+{
+	return ((uint32)pixel.R << 16) | ((uint32)pixel.G << 8) | (uint32)pixel.B;
+}
+
+// Open addressing hash table from packed 24 bit colors to pallete indices
+struct SColorHash
+{
+	void Init ()
+	{
+		m_keys.assign(256, c_emptyKey);
+		m_values.resize(256);
+		m_size = 0;
+	}
+
+	// returns the index stored for this color, or stores newIndex for it and returns that if the color isn't in the table yet
+	uint32 FindOrAdd (uint32 key, uint32 newIndex)
+	{
+		size_t slot = SlotForKey(key);
+		for (; m_keys[slot] != c_emptyKey; slot = (slot + 1) & (m_keys.size() - 1))
+		{
+			if (m_keys[slot] == key)
+				return m_values[slot];
+		}
+
+		m_keys[slot] = key;
+		m_values[slot] = newIndex;
+		++m_size;
+
+		// keep the table at most half full
+		if (m_size * 2 > m_keys.size())
+			Rehash(m_keys.size() * 2);
+		return newIndex;
+	}
+
+private:
+	// colors are 24 bits, so this can never be a real key
+	static const uint32 c_emptyKey = (uint32)-1;
+
+	size_t SlotForKey (uint32 key) const
+	{
+		return (size_t)((key * 0x9E3779B1u) >> 8) & (m_keys.size() - 1);
+	}
+
+	void Rehash (size_t numSlots)
+	{
+		std::vector<uint32> oldKeys;
+		std::vector<uint32> oldValues;
+		oldKeys.swap(m_keys);
+		oldValues.swap(m_values);
+		m_keys.assign(numSlots, c_emptyKey);
+		m_values.resize(numSlots);
+		for (size_t oldSlot = 0; oldSlot < oldKeys.size(); ++oldSlot)
+		{
+			if (oldKeys[oldSlot] == c_emptyKey)
+				continue;
+			size_t slot = SlotForKey(oldKeys[oldSlot]);
+			while (m_keys[slot] != c_emptyKey)
+				slot = (slot + 1) & (m_keys.size() - 1);
+			m_keys[slot] = oldKeys[oldSlot];
+			m_values[slot] = oldValues[oldSlot];
+		}
+	}
+
+	std::vector<uint32>	m_keys;
+	std::vector<uint32>	m_values;
+	size_t				m_size;
+};
+
+const uint32 SColorHash::c_emptyKey;
+
+uint32 GetOrMakePalleteIndex (SColorHash& colorHash, std::vector<SPixel>& pallete, const SPixel& pixel)
+{
+	// if this pixel value already exists in the pallete return it's index, else add it
+	uint32 index = colorHash.FindOrAdd(PackColor(pixel), (uint32)pallete.size());
+	if (index == pallete.size())
+		pallete.push_back(pixel);
+	return index;
+}
+
+void PalletizeImageRow (const SImageData& colorImage, SColorHash& colorHash, std::vector<SPixel>& pallete, uint32* destPixel, size_t y)
+{
+	// set the palletized pixel index to be the pallet index for the source pixel color.  Loaded images are read straight out of the
+	// mapped file.
+	colorImage.ForEachPixelInRow(y,
+		[&] (size_t x, const SPixel& pixel)
+		{
+			destPixel[x] = GetOrMakePalleteIndex(colorHash, pallete, pixel);
+		}
+	);
+}
+
+void PalletizeImage (const SImageData& colorImage, SPalletizedImageData& palletizedImage, size_t numThreads)
+{
+	PROFILE_SCOPE("PalletizeImage");
+	// copy properties of color image to palletized image
+	palletizedImage.m_width = colorImage.m_width;
+	palletizedImage.m_height = colorImage.m_height;
+	palletizedImage.m_pallete.clear();
+
+	// Each thread palletizes a band of rows against it's own pallete.  The band palletes are merged in band order, so colors get
+	// the index of their first occurrence in the image just like they would on one thread, and then each band is remapped to that.
+	// The final pixels are only as wide as the merged pallete needs, so the band indices go to a full width buffer first.
+	std::vector<uint32> bandPixels(colorImage.m_width * colorImage.m_height);
+	struct SBand
+	{
+		size_t				m_beginY;
+		size_t				m_endY;
+		std::vector<SPixel>	m_pallete;
+		std::vector<uint32>	m_remap;
+	};
+	std::vector<SBand> bands(std::max<size_t>(1, std::min(numThreads, colorImage.m_height)));
+	ParallelFor(colorImage.m_height, bands.size(),
+		[&] (size_t beginY, size_t endY, size_t threadIndex)
+		{
+			SBand& band = bands[threadIndex];
+			band.m_beginY = beginY;
+			band.m_endY = endY;
+			SColorHash colorHash;
+			colorHash.Init();
+			for (size_t y = beginY; y < endY; ++y)
+				PalletizeImageRow(colorImage, colorHash, band.m_pallete, &bandPixels[y * colorImage.m_width], y);
+		}
+	);
+
+	SColorHash colorHash;
+	colorHash.Init();
+	for (SBand& band : bands)
+	{
+		band.m_remap.resize(band.m_pallete.size());
+		for (size_t index = 0; index < band.m_pallete.size(); ++index)
+			band.m_remap[index] = GetOrMakePalleteIndex(colorHash, palletizedImage.m_pallete, band.m_pallete[index]);
+	}
+
+	palletizedImage.m_pixels.Init(palletizedImage.m_pallete.size(), palletizedImage.m_width * palletizedImage.m_height);
+	ParallelFor(bands.size(), bands.size(),
+		[&] (size_t beginBand, size_t endBand, size_t)
+		{
+			palletizedImage.m_pixels.Dispatch(
+				[&] (auto* destPixels)
+				{
+					typedef typename std::remove_pointer<decltype(destPixels)>::type T;
+					for (size_t bandIndex = beginBand; bandIndex < endBand; ++bandIndex)
+					{
+						const SBand& band = bands[bandIndex];
+						for (size_t pixelIndex = band.m_beginY * colorImage.m_width, endPixelIndex = band.m_endY * colorImage.m_width; pixelIndex < endPixelIndex; ++pixelIndex)
+							destPixels[pixelIndex] = (T)band.m_remap[bandPixels[pixelIndex]];
+					}
+				}
+			);
+		}
+	);
+
+	// calculate bits per pixel
+	size_t maxValue = 2;
+	palletizedImage.m_bpp = 1;
+	while (maxValue < palletizedImage.m_pallete.size())
+	{
+		maxValue *= 2;
+		++palletizedImage.m_bpp;
+	}
+}
+
+void ReportPalletizeImageScaling (SModel& model)
+{
+	// time palletization with every thread count from 1 up to the number of hardware threads
+	double baseSeconds = 0.0;
+	printf("PalletizeImage() scaling, %zu x %zu source image\n", model.m_colorImage.m_width, model.m_colorImage.m_height);
+	for (size_t threads = 1; threads <= GetDefaultThreadCount(); ++threads)
+	{
+		TClock::time_point start = TClock::now();
+		PalletizeImage(model.m_colorImage, model.m_palletizedImage, threads);
+		double seconds = SecondsSince(start);
+		if (threads == 1)
+			baseSeconds = seconds;
+		printf("  %2zu threads: %8.3f ms, %zu colors, speedup %0.2fx\n", threads, seconds * 1000.0, model.m_palletizedImage.m_pallete.size(), baseSeconds / seconds);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                PATTERN GATHERING
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The pattern gathering functions are templated on T, the type of the palletized image's pixels, and on TILE, the tile size if it has
+// it's own kernels.  GetPatterns() dispatches on both.  Specialized tile sizes keep their patterns in fixed size arrays.
+template <typename T, size_t TILE>
+using TTilePattern = typename std::conditional<TILE == 0, TPattern<T>, std::array<T, TILE * TILE>>::type;
+
+template <typename T>
+void ResizeTilePattern (TPattern<T>& pattern, size_t tileSize)
+{
+	pattern.resize(tileSize * tileSize);
+}
+
+template <typename T, size_t SIZE>
+void ResizeTilePattern (std::array<T, SIZE>&, size_t)
+{
+}
+
+template <size_t TILE, typename T, typename PATTERN>
+void GetPattern (const SPalletizedImageData& palletizedImage, const T* pixels, size_t startX, size_t startY, size_t tileSize, PATTERN& outPattern)
+{
+	tileSize = TileSize<TILE>(tileSize);
+	T* outPixel = &outPattern[0];
+
+	// windows that don't wrap around the edges of the image are copied a row at a time
+	if (startX + tileSize <= palletizedImage.m_width && startY + tileSize <= palletizedImage.m_height)
+	{
+		for (size_t iy = 0; iy < tileSize; ++iy)
+		{
+			const T* row = &pixels[(startY + iy) * palletizedImage.m_width + startX];
+			for (size_t ix = 0; ix < tileSize; ++ix)
+				*outPixel++ = row[ix];
+		}
+		return;
+	}
+
+	for (size_t iy = 0; iy < tileSize; ++iy)
+	{
+		size_t y = (startY + iy) % palletizedImage.m_height;
+		for (size_t ix = 0; ix < tileSize; ++ix)
+		{
+			size_t x = (startX + ix) % palletizedImage.m_width;
+			*outPixel = pixels[y*palletizedImage.m_width + x];
+			++outPixel;
+		}
+	}
+}
+
+// The pattern hash is a polynomial over the pixels: sum(pixel[y][x] * c_patternHashBaseX^(N-1-x) * c_patternHashBaseY^(N-1-y)).
+// That can be computed directly for a single pattern, or rolled across the source image a row and a column at a time.
+static const uint64 c_patternHashBaseX = 0x100000001B3ull;
+static const uint64 c_patternHashBaseY = 0x9E3779B97F4A7C15ull;
+
+inline uint64 PatternHashValue (uint32 pixel)
+{
+	// offset by one so that palette index 0 still changes the hash
+	return (uint64)pixel + 1;
+}
+
+template <size_t TILE, typename PATTERN>
+uint64 HashPattern (const PATTERN& pattern, size_t tileSize)
+{
+	tileSize = TileSize<TILE>(tileSize);
+	uint64 hash = 0;
+	for (size_t y = 0; y < tileSize; ++y)
+	{
+		uint64 rowHash = 0;
+		for (size_t x = 0; x < tileSize; ++x)
+			rowHash = rowHash * c_patternHashBaseX + PatternHashValue(pattern[y * tileSize + x]);
+		hash = hash * c_patternHashBaseY + rowHash;
+	}
+	return hash;
+}
+
+template <typename T>
+void GetPatternHashes (const SPalletizedImageData& palletizedImage, const T* pixels, size_t tileSize, size_t maxX, size_t maxY, size_t numThreads, std::vector<uint64>& outHashes)
+{
+	// Hash every tileSize wide run of pixels in each row by rolling the hash along the row, then roll those row hashes down each
+	// column to get the hash of every tileSize x tileSize window.  Wraps around the edges like GetPattern() does.
+	const size_t width = palletizedImage.m_width;
+	const size_t height = palletizedImage.m_height;
+	uint64 powX = 1;
+	uint64 powY = 1;
+	for (size_t i = 1; i < tileSize; ++i)
+	{
+		powX *= c_patternHashBaseX;
+		powY *= c_patternHashBaseY;
+	}
+
+	// rows and columns are independent of each other, so each pass is split across threads
+	std::vector<uint64> rowHashes(height * maxX);
+	ParallelFor(height, numThreads,
+		[&] (size_t beginY, size_t endY, size_t)
+		{
+			for (size_t y = beginY; y < endY; ++y)
+			{
+				const T* row = &pixels[y * width];
+				uint64 hash = 0;
+				for (size_t x = 0; x < tileSize; ++x)
+					hash = hash * c_patternHashBaseX + PatternHashValue(row[x % width]);
+				for (size_t x = 0; x < maxX; ++x)
+				{
+					rowHashes[y * maxX + x] = hash;
+					hash = (hash - PatternHashValue(row[x]) * powX) * c_patternHashBaseX + PatternHashValue(row[(x + tileSize) % width]);
+				}
+			}
+		}
+	);
+
+	outHashes.resize(maxY * maxX);
+	ParallelFor(maxX, numThreads,
+		[&] (size_t beginX, size_t endX, size_t)
+		{
+			for (size_t x = beginX; x < endX; ++x)
+			{
+				uint64 hash = 0;
+				for (size_t y = 0; y < tileSize; ++y)
+					hash = hash * c_patternHashBaseY + rowHashes[(y % height) * maxX + x];
+				for (size_t y = 0; y < maxY; ++y)
+				{
+					outHashes[y * maxX + x] = hash;
+					hash = (hash - rowHashes[y * maxX + x] * powY) * c_patternHashBaseY + rowHashes[((y + tileSize) % height) * maxX + x];
+				}
+			}
+		}
+	);
+}
+
+template <typename PATTERN>
+void AddPattern (SPatternTable& patterns, const PATTERN& pattern, uint64 hash)
+{
+	patterns.Add(&pattern[0], hash, 1);
+}
+
+template <size_t TILE, typename PATTERN>
+void ReflectPatternXAxis (const PATTERN& inPattern, PATTERN& outPattern, size_t tileSize)
+{
+	tileSize = TileSize<TILE>(tileSize);
+	for (size_t outY = 0; outY < tileSize; ++outY)
+	{
+		for (size_t outX = 0; outX < tileSize; ++outX)
+		{
+			size_t outIndex = outY * tileSize + outX;
+
+			size_t inX = tileSize - 1 - outX;
+			size_t inY = outY;
+			size_t inIndex = inY * tileSize + inX;
+			
+			outPattern[outIndex] = inPattern[inIndex];
+		}
+	}
+}
+
+template <size_t TILE, typename PATTERN>
+void RotatePatternCW90 (const PATTERN& inPattern, PATTERN& outPattern, size_t tileSize)
+{
+	tileSize = TileSize<TILE>(tileSize);
+	for (size_t outY = 0; outY < tileSize; ++outY)
+	{
+		for (size_t outX = 0; outX < tileSize; ++outX)
+		{
+			size_t outIndex = outY * tileSize + outX;
+
+            size_t inX = outY;
+            size_t inY = tileSize - 1 - outX;
 			size_t inIndex = inY * tileSize + inX;
 
-			outPattern[outIndex] = inPattern[inIndex];
-        }
-    }
+			outPattern[outIndex] = inPattern[inIndex];
+        }
+    }
+}
+
+// The orientations of a pattern, in the order that symmetry adds them: the pattern, it's reflection, the pattern rotated 90 degrees
+// clockwise, that's reflection, and so on.  Every orientation is a permutation of the pattern's pixels, so they are made once up front
+// by reflecting and rotating a pattern of pixel indices, and a window is oriented by looking up each pixel's source.
+static const size_t c_numOrientations = 8;
+
+struct SOrientationTables
+{
+	void Init (size_t tileSize)
+	{
+		m_patternSize = tileSize * tileSize;
+		TPattern<uint16> orientations[c_numOrientations];
+		orientations[0].resize(m_patternSize);
+		for (size_t index = 0; index < m_patternSize; ++index)
+			orientations[0][index] = (uint16)index;
+		for (size_t orientation = 1; orientation < c_numOrientations; ++orientation)
+		{
+			orientations[orientation].resize(m_patternSize);
+			if (orientation % 2 == 1)
+				ReflectPatternXAxis<0>(orientations[orientation - 1], orientations[orientation], tileSize);
+			else
+				RotatePatternCW90<0>(orientations[orientation - 2], orientations[orientation], tileSize);
+		}
+
+		m_sourceIndices.clear();
+		for (const TPattern<uint16>& orientation : orientations)
+			m_sourceIndices.insert(m_sourceIndices.end(), orientation.begin(), orientation.end());
+	}
+
+	const uint16* Orientation (size_t orientation) const { return &m_sourceIndices[orientation * m_patternSize]; }
+
+	size_t				m_patternSize;
+	std::vector<uint16>	m_sourceIndices;	// [orientation][tileSize*tileSize], the index in the pattern each pixel comes from
+};
+
+template <size_t TILE, typename PATTERN>
+void OrientPattern (const PATTERN& inPattern, const uint16* sourceIndices, PATTERN& outPattern, size_t tileSize)
+{
+	const size_t patternSize = TileSize<TILE>(tileSize) * TileSize<TILE>(tileSize);
+	for (size_t index = 0; index < patternSize; ++index)
+		outPattern[index] = inPattern[sourceIndices[index]];
+}
+
+// Returns the orientation of the pattern whose pixels come first lexicographically.  Every orientation of a pattern has the same
+// canonical form, so windows that are orientations of each other are counted together.
+template <size_t TILE, typename PATTERN>
+size_t CanonicalOrientation (const PATTERN& pattern, const SOrientationTables& orientations, size_t tileSize)
+{
+	const size_t patternSize = TileSize<TILE>(tileSize) * TileSize<TILE>(tileSize);
+	const uint16* best = orientations.Orientation(0);
+	size_t bestOrientation = 0;
+	for (size_t orientation = 1; orientation < c_numOrientations; ++orientation)
+	{
+		const uint16* sourceIndices = orientations.Orientation(orientation);
+		for (size_t index = 0; index < patternSize; ++index)
+		{
+			if (pattern[sourceIndices[index]] == pattern[best[index]])
+				continue;
+			if (pattern[sourceIndices[index]] < pattern[best[index]])
+			{
+				best = sourceIndices;
+				bestOrientation = orientation;
+			}
+			break;
+		}
+	}
+	return bestOrientation;
+}
+
+// With symmetry 8, every window adds one of each orientation, which is the same set of patterns as one of each orientation of it's
+// canonical form.  So only the canonical forms are gathered, with how many windows had each, and AddOrientations() adds all of their
+// orientations at the end.  Each window is then hashed at most once, instead of once per orientation.
+template <size_t TILE, typename T>
+void GetPatternsInRows (const SModel& model, const SOrientationTables& orientations, const T* pixels, const std::vector<uint64>& windowHashes, size_t maxX, size_t beginY, size_t endY, SPatternTable& patterns)
+{
+	TTilePattern<T, TILE> window;
+	TTilePattern<T, TILE> orientedWindow;
+	ResizeTilePattern(window, model.m_tileSize);
+	ResizeTilePattern(orientedWindow, model.m_tileSize);
+
+	for (size_t y = beginY; y < endY; ++y)
+	{
+		for (size_t x = 0; x < maxX; ++x)
+		{
+			GetPattern<TILE>(model.m_palletizedImage, pixels, x, y, model.m_tileSize, window);
+			const uint64 windowHash = windowHashes[y * maxX + x];
+
+			if (model.m_symmetry == c_numOrientations)
+			{
+				size_t orientation = CanonicalOrientation<TILE>(window, orientations, model.m_tileSize);
+				if (orientation == 0)
+				{
+					AddPattern(patterns, window, windowHash);
+					continue;
+				}
+				OrientPattern<TILE>(window, orientations.Orientation(orientation), orientedWindow, model.m_tileSize);
+				AddPattern(patterns, orientedWindow, HashPattern<TILE>(orientedWindow, model.m_tileSize));
+				continue;
+			}
+
+			// otherwise add the window and as many of it's orientations as the symmetry parameter asks for
+			AddPattern(patterns, window, windowHash);
+			for (size_t orientation = 1; orientation < model.m_symmetry; ++orientation)
+			{
+				OrientPattern<TILE>(window, orientations.Orientation(orientation), orientedWindow, model.m_tileSize);
+				AddPattern(patterns, orientedWindow, HashPattern<TILE>(orientedWindow, model.m_tileSize));
+			}
+		}
+	}
+}
+
+// Adds every orientation of each canonical pattern, with the canonical pattern's count.  A pattern that is symmetric has orientations
+// that are the same as each other, and those add up, just like they would if each window's orientations had been added.
+template <size_t TILE, typename T>
+void AddOrientations (const SPatternTable& canonicalPatterns, const SOrientationTables& orientations, size_t tileSize, SPatternTable& patterns)
+{
+	TTilePattern<T, TILE> pattern;
+	TTilePattern<T, TILE> orientedPattern;
+	ResizeTilePattern(pattern, tileSize);
+	ResizeTilePattern(orientedPattern, tileSize);
+	for (size_t index = 0; index < canonicalPatterns.Size(); ++index)
+	{
+		const T* canonicalPattern = canonicalPatterns.Pattern<T>(index);
+		std::copy(canonicalPattern, canonicalPattern + canonicalPatterns.m_patternSize, &pattern[0]);
+		patterns.Add(&pattern[0], canonicalPatterns.m_hashes[index], canonicalPatterns.Count(index));
+		for (size_t orientation = 1; orientation < c_numOrientations; ++orientation)
+		{
+			OrientPattern<TILE>(pattern, orientations.Orientation(orientation), orientedPattern, tileSize);
+			patterns.Add(&orientedPattern[0], HashPattern<TILE>(orientedPattern, tileSize), canonicalPatterns.Count(index));
+		}
+	}
+}
+
+template <size_t TILE, typename T>
+void GetPatterns (SModel& model, const T* pixels)
+{
+	size_t maxX = model.m_palletizedImage.m_width - (model.m_periodicInput ? model.m_tileSize : 0);
+	size_t maxY = model.m_palletizedImage.m_height - (model.m_periodicInput ? model.m_tileSize : 0);
+
+	SOrientationTables orientations;
+	orientations.Init(model.m_tileSize);
+
+	// hash all of the windows in the source image up front
+	std::vector<uint64> windowHashes;
+	GetPatternHashes(model.m_palletizedImage, pixels, model.m_tileSize, maxX, maxY, model.m_numThreads, windowHashes);
+
+	// Each thread gathers the patterns from a band of rows into it's own table.  The tables are then merged in band order, which
+	// gives every pattern the same index it would have gotten if the whole image was gathered on one thread.
+	std::vector<SPatternTable> bandPatterns(std::max<size_t>(1, std::min(model.m_numThreads, maxY)));
+	ParallelFor(maxY, bandPatterns.size(),
+		[&] (size_t beginY, size_t endY, size_t threadIndex)
+		{
+			bandPatterns[threadIndex].Init(model.m_tileSize, model.m_palletizedImage.m_pallete.size());
+			GetPatternsInRows<TILE>(model, orientations, pixels, windowHashes, maxX, beginY, endY, bandPatterns[threadIndex]);
+		}
+	);
+
+	SPatternTable canonicalPatterns;
+	SPatternTable& mergedPatterns = model.m_symmetry == c_numOrientations ? canonicalPatterns : model.m_patterns;
+	mergedPatterns.Init(model.m_tileSize, model.m_palletizedImage.m_pallete.size());
+	for (const SPatternTable& band : bandPatterns)
+	{
+		for (size_t index = 0; index < band.Size(); ++index)
+			mergedPatterns.Add(band.Pattern<T>(index), band.m_hashes[index], band.Count(index));
+	}
+
+	if (model.m_symmetry == c_numOrientations)
+	{
+		model.m_patterns.Init(model.m_tileSize, model.m_palletizedImage.m_pallete.size());
+		AddOrientations<TILE, T>(canonicalPatterns, orientations, model.m_tileSize, model.m_patterns);
+	}
+}
+
+void GetPatterns (SModel& model)
+{
+	PROFILE_SCOPE("GetPatterns");
+	DispatchTileSize(model,
+		[&] (auto tile)
+		{
+			model.m_palletizedImage.m_pixels.Dispatch(
+				[&] (const auto* pixels)
+				{
+					GetPatterns<decltype(tile)::value>(model, pixels);
+				}
+			);
+		}
+	);
+}
+
+void ReportGetPatternsScaling (SModel& model)
+{
+	// time pattern gathering with every thread count from 1 up to the number of hardware threads
+	const size_t numThreads = model.m_numThreads;
+	double baseSeconds = 0.0;
+	printf("GetPatterns() scaling, %zu x %zu source image, N = %zu, symmetry = %u\n", model.m_palletizedImage.m_width, model.m_palletizedImage.m_height, model.m_tileSize, model.m_symmetry);
+	for (size_t threads = 1; threads <= GetDefaultThreadCount(); ++threads)
+	{
+		model.m_numThreads = threads;
+		TClock::time_point start = TClock::now();
+		GetPatterns(model);
+		double seconds = SecondsSince(start);
+		if (threads == 1)
+			baseSeconds = seconds;
+		printf("  %2zu threads: %8.3f ms, %zu patterns, speedup %0.2fx\n", threads, seconds * 1000.0, model.m_patterns.Size(), baseSeconds / seconds);
+	}
+	model.m_numThreads = numThreads;
+}
+
+void SavePatterns (const SModel& model)
+{
+    SImageData tempImageData;
+    tempImageData.Allocate(model.m_tileSize, model.m_tileSize);
+	for (uint64 patternIndex = 0; patternIndex < model.m_patterns.Size(); ++patternIndex)
+    {
+        for (size_t y = 0; y < model.m_tileSize; ++y)
+        {
+            for (size_t x = 0; x < model.m_tileSize; ++x)
+                tempImageData.MutableRow(y)[x] = model.m_palletizedImage.m_pallete[model.m_patterns.Pixel((size_t)patternIndex, y * model.m_tileSize + x)];
+        }
+
+        char buffer[256];
+        sprintf(buffer, ".Pattern%I64i.%I64i.bmp", patternIndex, model.m_patterns.Count((size_t)patternIndex));
+
+        char fileName[256];
+        strcpy(fileName, model.m_fileName.c_str());
+        strcat(fileName, buffer);
+
+        SaveImage(fileName, tempImageData);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                SIMPLE TILED MODEL
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The simple tiled model cuts a tileset image into N x N tiles, numbered left to right then top to bottom, and solves for one tile
+// per output pixel, so the output image is N times the output size.  Tiles are stored as the model's patterns, one possibility each,
+// so everything but propagation is shared with the overlapping model.  Instead of a propagator, adjacency rules say which tiles can be
+// next to each other, and only the 4 pixels that share an edge with a pixel are constrained by it.  Identical tiles stay separate
+// tiles, since rules can treat them differently.
+
+template <typename T>
+void GetTiles (SModel& model, const T* pixels)
+{
+	const SPalletizedImageData& palletizedImage = model.m_palletizedImage;
+	const size_t tileSize = model.m_tileSize;
+	TPattern<T> tile(tileSize * tileSize);
+	model.m_patterns.Init(tileSize, palletizedImage.m_pallete.size());
+
+	// rows are stored bottom to top, so the top row of tiles is the last one
+	for (size_t tileY = 0; tileY < palletizedImage.m_height / tileSize; ++tileY)
+	{
+		const size_t y = palletizedImage.m_height - (tileY + 1) * tileSize;
+		for (size_t x = 0; x + tileSize <= palletizedImage.m_width; x += tileSize)
+		{
+			GetPattern<0>(palletizedImage, pixels, x, y, tileSize, tile);
+			model.m_patterns.Append(&tile[0], HashPattern<0>(tile, tileSize), 1);
+		}
+	}
+}
+
+void GetTiles (SModel& model)
+{
+	PROFILE_SCOPE("GetTiles");
+	model.m_palletizedImage.m_pixels.Dispatch(
+		[&] (const auto* pixels)
+		{
+			GetTiles(model, pixels);
+		}
+	);
+}
+
+// Without rules, tile B can be right of tile A if A's right column matches B's left column, and above it if A's top row matches B's
+// bottom row
+void GetEdgeAdjacency (SModel& model)
+{
+	const SPatternTable& tiles = model.m_patterns;
+	const size_t tileSize = model.m_tileSize;
+	for (size_t tileA = 0; tileA < tiles.Size(); ++tileA)
+	{
+		for (size_t tileB = 0; tileB < tiles.Size(); ++tileB)
+		{
+			bool horizontal = true;
+			bool vertical = true;
+			for (size_t i = 0; i < tileSize; ++i)
+			{
+				horizontal = horizontal && tiles.Pixel(tileA, i * tileSize + tileSize - 1) == tiles.Pixel(tileB, i * tileSize);
+				vertical = vertical && tiles.Pixel(tileA, (tileSize - 1) * tileSize + i) == tiles.Pixel(tileB, i);
+			}
+			if (horizontal)
+				model.m_tileAdjacency.Allow(c_tileDirectionRight, tileA, tileB);
+			if (vertical)
+				model.m_tileAdjacency.Allow(c_tileDirectionUp, tileA, tileB);
+		}
+	}
+}
+
+// Reads the model's adjacency rules, one per line:
+//
+//   h A B       tile B can be right of tile A
+//   v A B       tile B can be above tile A
+//   weight A W  tile A is picked W times as often as a tile with weight 1, which is every tile's default
+//
+// Blank lines and lines starting with # are skipped.  Returns false if the file can't be read or has a line that isn't a rule.
+bool LoadTileRules (SModel& model)
+{
+	FILE* file = fopen(model.m_rulesFileName.c_str(), "rt");
+	if (!file)
+	{
+		fprintf(stderr, "Could not load tile rules: %s\n", model.m_rulesFileName.c_str());
+		return false;
+	}
+
+	const unsigned long long numTiles = model.m_patterns.Size();
+	bool success = true;
+	char line[256];
+	for (size_t lineNumber = 1; fgets(line, sizeof(line), file); ++lineNumber)
+	{
+		char rule[16];
+		unsigned long long a = 0, b = 0;
+		const int fields = sscanf(line, "%15s %llu %llu", rule, &a, &b);
+		if (fields <= 0 || rule[0] == '#')
+			continue;
+
+		const bool validTile = fields == 3 && a < numTiles;
+		if (validTile && b < numTiles && !strcmp(rule, "h"))
+			model.m_tileAdjacency.Allow(c_tileDirectionRight, (size_t)a, (size_t)b);
+		else if (validTile && b < numTiles && !strcmp(rule, "v"))
+			model.m_tileAdjacency.Allow(c_tileDirectionUp, (size_t)a, (size_t)b);
+		else if (validTile && b > 0 && !strcmp(rule, "weight"))
+			model.m_patterns.m_counts[(size_t)a] = b;
+		else
+		{
+			fprintf(stderr, "%s(%zu): not a rule for %llu tiles: %s", model.m_rulesFileName.c_str(), lineNumber, numTiles, line);
+			success = false;
+		}
+	}
+	fclose(file);
+	return success;
+}
+
+bool BuildTileAdjacency (SModel& model)
+{
+	PROFILE_SCOPE("BuildTileAdjacency");
+	model.m_tileAdjacency.Init(model.m_patterns.Size());
+	if (model.m_rulesFileName.empty())
+	{
+		GetEdgeAdjacency(model);
+		return true;
+	}
+	return LoadTileRules(model);
+}
+
+// BuildModel() for the simple tiled model.  Tiles are one possibility per pixel, like the anchored domain.
+bool BuildTiledModel (SModel& model)
+{
+	TClock::time_point start = TClock::now();
+	if (!LoadImage(model.m_fileName.c_str(), model.m_colorImage))
+		return false;
+	model.m_loadSeconds = SecondsSince(start);
+
+	start = TClock::now();
+	PalletizeImage(model.m_colorImage, model.m_palletizedImage, model.m_numThreads);
+	model.m_palletizeSeconds = SecondsSince(start);
+
+	start = TClock::now();
+	GetTiles(model);
+	model.m_patternsSeconds = SecondsSince(start);
+	if (model.m_patterns.Size() == 0)
+	{
+		fprintf(stderr, "%s is smaller than one %zu x %zu tile\n", model.m_fileName.c_str(), model.m_tileSize, model.m_tileSize);
+		return false;
+	}
+
+	start = TClock::now();
+	if (!BuildTileAdjacency(model))
+		return false;
+	model.m_propagatorSeconds = SecondsSince(start);
+
+	model.m_domain = EDomain::e_patternAnchored;
+	model.m_positionsPerAxis = 1;
+	model.m_boolsPerPixel = model.m_patterns.Size();
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                UNORGANIZED
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+enum class EObserveResult {
+	e_success,
+	e_failure,
+	e_notDone
+};
+
+inline void RemoveFromEntropyTotals (SContext& context, size_t pixelIndex, size_t possibility)
+{
+	// every engine's bans come through here, so this is where they get logged for backtracking
+	SUndoLog& undoLog = context.m_undoLog;
+	if (undoLog.Recording())
+	{
+		undoLog.m_bans.push_back({ (uint32)pixelIndex, (uint32)possibility });
+		if (undoLog.m_cellEntropyEpoch[pixelIndex] != undoLog.m_epoch)
+		{
+			undoLog.m_cellEntropyEpoch[pixelIndex] = undoLog.m_epoch;
+			undoLog.m_cellEntropies.push_back({ pixelIndex, context.m_cellEntropy[pixelIndex] });
+		}
+	}
+
+	PROFILE_COUNT(e_bans, 1);
+	SCellEntropy& cellEntropy = context.m_cellEntropy[pixelIndex];
+	cellEntropy.m_sumWeights -= context.m_possibilityWeights[possibility];
+	cellEntropy.m_sumWeightLogWeights -= context.m_possibilityWeightLogWeights[possibility];
+	--cellEntropy.m_remaining;
+
+	// a decided pixel that loses it's last possibility isn't in the heap any more, so put it back for Observe() to find
+	if (cellEntropy.m_remaining == 0 && !context.m_entropyHeap.Contains(pixelIndex))
+		context.m_entropyHeap.Push(pixelIndex, CellEntropyKey(cellEntropy, context.m_entropyHeuristic));
+}
+
+inline void RemovePossibility (SContext& context, size_t pixelIndex, size_t possibility)
+{
+	// take the possibility out of the running entropy totals for this pixel, and remember that we've changed this pixel, so that
+	// Propagate() will propagate the change to it's neighbors
+	RemoveFromEntropyTotals(context, pixelIndex, possibility);
+
+	bool emptiedPosition = false;
+	if (context.m_propagationEngine == EPropagationEngine::e_supportCounters)
+	{
+		const size_t positionCount = context.m_positionsPerAxis * context.m_positionsPerAxis;
+		emptiedPosition = --context.m_positionCounts[pixelIndex * positionCount + possibility % positionCount] == 0;
+	}
+	context.m_propagationQueue.Push(pixelIndex, possibility, emptiedPosition);
+}
+
+void BanPossibilities (SContext& context, size_t pixelIndex, const uint64* keepMask)
+{
+	uint64* cell = context.m_wave.Cell(pixelIndex);
+	bool changed = false;
+	for (size_t wordIndex = 0; wordIndex < context.m_wave.m_wordsPerCell; ++wordIndex)
+	{
+		uint64 banned = cell[wordIndex] & ~keepMask[wordIndex];
+		while (banned)
+		{
+			RemovePossibility(context, pixelIndex, wordIndex * 64 + CountTrailingZeros(banned));
+			banned &= banned - 1;
+			changed = true;
+		}
+	}
+
+	if (!changed)
+		return;
+
+	WaveAndMask(cell, keepMask, context.m_wave.m_wordsPerCell);
+	context.m_entropyHeap.Update(pixelIndex, CellEntropyKey(context.m_cellEntropy[pixelIndex], context.m_entropyHeuristic));
+}
+
+void BanPossibility (SContext& context, size_t pixelIndex, size_t possibility)
+{
+	uint64* cell = context.m_wave.Cell(pixelIndex);
+	cell[possibility / 64] &= ~((uint64)1 << (possibility % 64));
+	RemovePossibility(context, pixelIndex, possibility);
+	context.m_entropyHeap.Update(pixelIndex, CellEntropyKey(context.m_cellEntropy[pixelIndex], context.m_entropyHeuristic));
+}
+
+// How many output image pixels wide and tall each solved pixel is: a whole tile for the simple tiled model
+inline size_t OutputPixelsPerPixel (const SModel& model)
+{
+	return model.m_type == EModelType::e_simpleTiled ? model.m_tileSize : 1;
+}
+
+// Fills row with pixel row tileY of the tiles decided in row y of the output.  Undecided tiles are black.
+void GetTileRow (const SContext& context, size_t y, size_t tileY, SPixel* row)
+{
+	const SIndexArray& tiles = context.m_observedPixels.m_patterns;
+	for (size_t x = 0; x < context.m_outputImageWidth; ++x)
+	{
+		const uint32 tile = tiles.Get(y * context.m_outputImageWidth + x);
+		for (size_t tileX = 0; tileX < context.m_tileSize; ++tileX, ++row)
+			*row = tile == tiles.None() ? SPixel{ 0, 0, 0 } : context.m_palletizedImage.m_pallete[context.m_patterns.Pixel(tile, tileY * context.m_tileSize + tileX)];
+	}
+}
+
+// Queues row y of the output to the context's stream writer, which is a tile's worth of rows for the simple tiled model.  Undecided
+// pixels are written as black.
+void StreamRow (SContext& context, size_t y)
+{
+	if (context.m_model.m_type == EModelType::e_simpleTiled)
+	{
+		for (size_t tileY = 0; tileY < context.m_tileSize; ++tileY)
+		{
+			GetTileRow(context, y, tileY, &context.m_streamRow[0]);
+			context.m_streamWriter->QueueRow(y * context.m_tileSize + tileY, &context.m_streamRow[0]);
+		}
+		return;
+	}
+
+	const SIndexArray& colors = context.m_observedPixels.m_colors;
+	for (size_t x = 0; x < context.m_outputImageWidth; ++x)
+	{
+		uint32 color = colors.Get(y * context.m_outputImageWidth + x);
+		context.m_streamRow[x] = color == colors.None() ? SPixel{ 0, 0, 0 } : context.m_palletizedImage.m_pallete[color];
+	}
+	context.m_streamWriter->QueueRow(y, &context.m_streamRow[0]);
+}
+
+// Queues the rows that never got all their pixels decided, so the stream ends up with every row, like SaveObservedImage() would write
+void StreamUnfinishedRows (SContext& context)
+{
+	for (size_t y = 0; y < context.m_outputImageHeight; ++y)
+	{
+		if (context.m_rowUndecidedPixels[y] > 0)
+			StreamRow(context, y);
+	}
+}
+
+// The color a possibility gives it's pixel
+inline uint32 PossibilityColor (const SContext& context, size_t possibility)
+{
+	const size_t positionCount = context.m_positionsPerAxis * context.m_positionsPerAxis;
+	size_t positionIndex = possibility % positionCount;
+	size_t patternPixelIndex = (positionIndex / context.m_positionsPerAxis) * context.m_tileSize + positionIndex % context.m_positionsPerAxis;
+	return context.m_patterns.Pixel(possibility / positionCount, patternPixelIndex);
+}
+
+void DecidePixel (SContext& context, size_t pixelIndex, size_t possibility)
+{
+	// set the observed color
+	const size_t positionCount = context.m_positionsPerAxis * context.m_positionsPerAxis;
+	size_t patternIndex = possibility / positionCount;
+	size_t positionIndex = possibility % positionCount;
+	TRACE("%s(): pixel %zu,%zu decided on pattern %zu, offset %zu\n", __FUNCTION__, pixelIndex % context.m_outputImageWidth, pixelIndex / context.m_outputImageWidth, patternIndex, positionIndex);
+	const bool wasUndecided = context.m_observedPixels.m_patterns.Get(pixelIndex) == context.m_observedPixels.m_patterns.None();
+	context.m_observedPixels.Set(pixelIndex, PossibilityColor(context, possibility), patternIndex, positionIndex);
+	context.m_entropyHeap.Remove(pixelIndex);
+	if (context.m_streamWriter && wasUndecided && --context.m_rowUndecidedPixels[pixelIndex / context.m_outputImageWidth] == 0)
+		StreamRow(context, pixelIndex / context.m_outputImageWidth);
+
+	// mark every other possibility as not possible. This queues the pixel so that Propogate() knows to propagate it's changes
+	std::fill(context.m_scratchMask.begin(), context.m_scratchMask.end(), 0);
+	context.m_scratchMask[possibility / 64] = (uint64)1 << (possibility % 64);
+	BanPossibilities(context, pixelIndex, &context.m_scratchMask[0]);
+}
+
+void Checkpoint (SContext& context, size_t pixelIndex, size_t possibility)
+{
+	// remember the decision, so Backtrack() can undo back to here.  If that would go over budget, the oldest half become permanent.
+	SUndoLog& undoLog = context.m_undoLog;
+	if (!undoLog.Enabled())
+		return;
+
+	undoLog.m_maxBytesUsed = std::max(undoLog.m_maxBytesUsed, undoLog.Bytes());
+	if (undoLog.m_decisions.size() >= undoLog.m_maxDepth || undoLog.Bytes() > undoLog.m_maxBytes)
+		undoLog.Commit(std::max<size_t>(1, undoLog.m_decisions.size() / 2));
+
+	undoLog.m_decisions.push_back({ pixelIndex, possibility, undoLog.m_bans.size(), undoLog.m_propagated.size(), undoLog.m_cellEntropies.size() });
+	++undoLog.m_epoch;
+}
+
+void ObservePixel (SContext& context, size_t pixelIndex)
+{
+	// select a possibility for this pixel, with each possibility weighted by how often its pattern appeared in the source image
+	const SCellEntropy& cellEntropy = context.m_cellEntropy[pixelIndex];
+	uint64 selectedPossibility = context.m_prng.RandomInt<uint64>(0, cellEntropy.m_sumWeights - 1);
+	const uint64* cell = context.m_wave.Cell(pixelIndex);
+	size_t selectedBit = (size_t)-1;
+	for (size_t wordIndex = 0; wordIndex < context.m_wave.m_wordsPerCell && selectedBit == (size_t)-1; ++wordIndex)
+	{
+		uint64 word = cell[wordIndex];
+		while (word)
+		{
+			size_t bit = wordIndex * 64 + CountTrailingZeros(word);
+			word &= word - 1;
+
+			const uint64 currentPatternCount = context.m_possibilityWeights[bit];
+			if (selectedPossibility >= currentPatternCount)
+			{
+				selectedPossibility -= currentPatternCount;
+				continue;
+			}
+
+			selectedBit = bit;
+			break;
+		}
+	}
+
+	PROFILE_COUNT(e_observations, 1);
+	Checkpoint(context, pixelIndex, selectedBit);
+	DecidePixel(context, pixelIndex, selectedBit);
+}
+
+EObserveResult Observe (SContext& context, size_t& undecidedPixels)
+{
+	PROFILE_SCOPE("Observe");
+	// if all pixels are decided (no entropy left in the image), return success
+	undecidedPixels = context.m_entropyHeap.Size();
+	if (context.m_entropyHeap.Empty())
+	{
+		TRACE("%s(): all pixels decided, finished!\n", __FUNCTION__);
+		return EObserveResult::e_success;
+	}
+
+	// Find the pixel with the smallest entropy (uncertainty), which isn't yet observed/decided. The heap keeps them sorted for us.
+	size_t pixelIndex = context.m_entropyHeap.Top();
+
+	// if no possibilities, this is an impossible pixel
+	if (context.m_cellEntropy[pixelIndex].m_remaining == 0)
+	{
+		TRACE("%s(): found impossible pixel: (%zu, %zu)\n", __FUNCTION__, pixelIndex % context.m_outputImageWidth, pixelIndex / context.m_outputImageWidth);
+		PROFILE_COUNT(e_contradictions, 1);
+		return EObserveResult::e_failure;
+	}
+
+	ObservePixel(context, pixelIndex);
+
+	// return that we still have more work to do
+	return EObserveResult::e_notDone;	
+}
+
+template <typename T>
+bool PatternMatches (const T* patternA, const T* patternB, int patternAOffsetX, int patternAOffsetY, int patternBOffsetX, int patternBOffsetY, size_t tileSize)
+{
+	PROFILE_COUNT(e_patternCompares, 1);
+
+    // TODO: could easily find the min/max x and y to iterate over here
+	for (int y = -(int)tileSize+1; y < (int)tileSize; ++y)
+	{
+		int pay = y + patternAOffsetY;
+		int pby = y + patternBOffsetY;
+		if (pay < 0 || pby < 0 || pay >= tileSize || pby >= tileSize)
+			continue;
+
+		for (int x = -(int)tileSize + 1; x < (int)tileSize; ++x)
+		{
+			int pax = x + patternAOffsetX;
+			int pbx = x + patternBOffsetX;
+			if (pax < 0 || pbx < 0 || pax >= tileSize || pbx >= tileSize)
+				continue;
+
+			if (patternA[pay*tileSize + pax] != patternB[pby*tileSize + pbx])
+				return false;
+		}
+	}
+	return true;
+}
+
+// Returns whether pattern B agrees with pattern A on every overlapping pixel, when B is placed at an offset of (dx, dy) from A
+template <size_t TILE, typename T>
+bool PatternsAgree (const T* A, const T* B, int dx, int dy, int tileSize)
+{
+	tileSize = (int)TileSize<TILE>(tileSize);
+	int xmin = dx < 0 ? 0 : dx;
+	int xmax = dx < 0 ? dx + tileSize : tileSize;
+	int ymin = dy < 0 ? 0 : dy;
+	int ymax = dy < 0 ? dy + tileSize : tileSize;
+	for (int y = ymin; y < ymax; y++)
+	{
+		for (int x = xmin; x < xmax; x++)
+		{
+			if (A[x + tileSize * y] != B[x - dx + tileSize * (y - dy)])
+				return false;
+		}
+	}
+	return true;
+}
+
+template <size_t TILE>
+void BuildPropagator (SModel& model)
+{
+	// m_propagator.List((y*dims+x)*numPatterns + t) is the list of patterns t2 which agree with pattern t on every overlapping pixel, when
+	// t2 is placed at an offset of (x - tileSize + 1, y - tileSize + 1) from t.  Offsets further away than that don't overlap at all.
+	const int tileSize = (int)TileSize<TILE>(model.m_tileSize);
+	const int numPatterns = (int)model.m_patterns.Size();
+	const int dims = tileSize * 2 - 1;
+	model.m_propagator.Clear();
+	model.m_patterns.m_pixels.Dispatch(
+		[&] (const auto* patternPixels)
+		{
+			const size_t patternSize = model.m_patterns.m_patternSize;
+			for (int y = 0; y < dims; ++y)
+			{
+				for (int x = 0; x < dims; ++x)
+				{
+					for (int t = 0; t < numPatterns; ++t)
+					{
+						model.m_propagator.BeginList();
+						for (int t2 = 0; t2 < numPatterns; t2++)
+						{
+							if (PatternsAgree<TILE>(patternPixels + t * patternSize, patternPixels + t2 * patternSize, x - tileSize + 1, y - tileSize + 1, tileSize))
+								model.m_propagator.AddPattern(t2);
+						}
+					}
+				}
+			}
+		}
+	);
+	model.m_propagator.Finish();
+	PROFILE_COUNT(e_patternCompares, (uint64)dims * dims * numPatterns * numPatterns);
+}
+
+void BuildPropagator (SModel& model)
+{
+	PROFILE_SCOPE("BuildPropagator");
+	DispatchTileSize(model,
+		[&] (auto tile)
+		{
+			BuildPropagator<decltype(tile)::value>(model);
+		}
+	);
+}
+
+// Gets the pixel at (x, y) + (offsetX, offsetY).  Wraps around if the output is periodic, otherwise returns false if it's off the edge.
+inline bool GetNeighborPixel (const SContext& context, size_t x, size_t y, int offsetX, int offsetY, size_t& neighborX, size_t& neighborY)
+{
+	if (context.m_periodicOutput)
+	{
+		neighborX = (x + offsetX + context.m_outputImageWidth) % context.m_outputImageWidth;
+		neighborY = (y + offsetY + context.m_outputImageHeight) % context.m_outputImageHeight;
+		return true;
+	}
+
+	neighborX = x + offsetX;
+	neighborY = y + offsetY;
+	return neighborX < context.m_outputImageWidth && neighborY < context.m_outputImageHeight;
+}
+
+// Calls f() with every possibility in the pixel at changedPixel + (offsetX, offsetY) whose pattern overlaps and agrees with the given
+// possibility in changedPixel.
+template <typename LAMBDA>
+void ForEachSupportedPossibility (const SContext& context, size_t possibility, int offsetX, int offsetY, LAMBDA&& f)
+{
+	// This is the same relationship PatternSupported() checks, looked at from the other side: the changed pattern is offset from the
+	// affected pattern by affectedPosition - changedPosition - offset, so the affected pattern is offset by the negative of that from
+	// the changed pattern.
+	const int tileSize = (int)context.m_tileSize;
+	const int dims = tileSize * 2 - 1;
+	const size_t positionCount = context.m_positionsPerAxis * context.m_positionsPerAxis;
+	const size_t numPatterns = context.m_patterns.Size();
+	const int positionsPerAxis = (int)context.m_positionsPerAxis;
+	const size_t changedPatternIndex = possibility / positionCount;
+	const int changedPositionX = (int)((possibility % positionCount) % context.m_positionsPerAxis);
+	const int changedPositionY = (int)((possibility % positionCount) / context.m_positionsPerAxis);
+	for (int affectedPositionY = std::max(0, changedPositionY + offsetY - tileSize + 1), stopY = std::min(positionsPerAxis, changedPositionY + offsetY + tileSize); affectedPositionY < stopY; ++affectedPositionY)
+	{
+		int dy = affectedPositionY - changedPositionY - offsetY;
+		for (int affectedPositionX = std::max(0, changedPositionX + offsetX - tileSize + 1), stopX = std::min(positionsPerAxis, changedPositionX + offsetX + tileSize); affectedPositionX < stopX; ++affectedPositionX)
+		{
+			int dx = affectedPositionX - changedPositionX - offsetX;
+			size_t affectedPositionIndex = affectedPositionY * positionsPerAxis + affectedPositionX;
+			SPropagator::SList list = context.m_propagator.List(((-dy + tileSize - 1)*dims - dx + tileSize - 1)*numPatterns + changedPatternIndex);
+			for (size_t affectedPatternIndex : list)
+				f(affectedPatternIndex * positionCount + affectedPositionIndex);
+		}
+	}
+}
+
+// Calls f() with every position in the pixel at changedPixel + (offsetX, offsetY) where no pattern overlaps a pattern at the given
+// position in changedPixel.
+template <typename LAMBDA>
+void ForEachNonOverlappingPosition (const SContext& context, size_t changedPosition, int offsetX, int offsetY, LAMBDA&& f)
+{
+	const int tileSize = (int)context.m_tileSize;
+	const int positionsPerAxis = (int)context.m_positionsPerAxis;
+	const int changedPositionX = (int)(changedPosition % context.m_positionsPerAxis);
+	const int changedPositionY = (int)(changedPosition / context.m_positionsPerAxis);
+	for (int affectedPositionY = 0; affectedPositionY < positionsPerAxis; ++affectedPositionY)
+	{
+		int dy = affectedPositionY - changedPositionY - offsetY;
+		for (int affectedPositionX = 0; affectedPositionX < positionsPerAxis; ++affectedPositionX)
+		{
+			int dx = affectedPositionX - changedPositionX - offsetX;
+			if (dx <= -tileSize || dx >= tileSize || dy <= -tileSize || dy >= tileSize)
+				f(affectedPositionY * positionsPerAxis + affectedPositionX);
+		}
+	}
+}
+
+// changedCell is the changed pixel's wave cell, and changedPixelPositions says which positions have any pattern left in it
+bool PatternSupported (const SContext& context, const uint64* changedCell, const uint8* changedPixelPositions, size_t affectedPatternIndex, int affectedPositionX, int affectedPositionY, int patternOffsetX, int patternOffsetY)
+{
+	// The affected pixel's pattern is anchored at affectedPixel - affectedPosition, and a changed pixel possibility is anchored at
+	// changedPixel - changedPosition.  The changed pattern is therefore offset from the affected pattern by
+	// affectedPosition - changedPosition - patternOffset, which is what the propagator is indexed by.
+	const int tileSize = (int)context.m_tileSize;
+	const int dims = tileSize * 2 - 1;
+	const size_t positionCount = context.m_positionsPerAxis * context.m_positionsPerAxis;
+	const size_t numPatterns = context.m_patterns.Size();
+	const int positionsPerAxis = (int)context.m_positionsPerAxis;
+	PROFILE_COUNT(e_patternCompares, 1);
+	for (int changedPositionY = 0; changedPositionY < positionsPerAxis; ++changedPositionY)
+	{
+		int dy = affectedPositionY - changedPositionY - patternOffsetY;
+		for (int changedPositionX = 0; changedPositionX < positionsPerAxis; ++changedPositionX)
+		{
+			int dx = affectedPositionX - changedPositionX - patternOffsetX;
+			size_t changedPositionIndex = changedPositionY * positionsPerAxis + changedPositionX;
+
+			// if the patterns don't overlap, any pattern at this position in the changed pixel is support
+			if (dx <= -tileSize || dx >= tileSize || dy <= -tileSize || dy >= tileSize)
+			{
+				if (changedPixelPositions[changedPositionIndex])
+					return true;
+				continue;
+			}
+
+			// otherwise only the patterns the propagator says agree with us are support
+			if (!changedPixelPositions[changedPositionIndex])
+				continue;
+			SPropagator::SList list = context.m_propagator.List(((dy + tileSize - 1)*dims + dx + tileSize - 1)*numPatterns + affectedPatternIndex);
+			for (size_t changedPatternIndex : list)
+			{
+				size_t bit = changedPatternIndex * positionCount + changedPositionIndex;
+				if ((changedCell[bit / 64] >> (bit % 64)) & 1)
+					return true;
+			}
+		}
+	}
+	return false;
+}
+
+void PropagatePatternRestrictions (SContext& context, size_t changedPixelX, size_t changedPixelY, size_t affectedPixelX, size_t affectedPixelY, int patternOffsetX, int patternOffsetY)
+{
+	TRACE("  affecting %zu,%zu\n", affectedPixelX, affectedPixelY);
+
+    // If any possible pattern in the affectedPixel doesn't match a possible pattern in changedPixel, mark it as impossible.
+    // Note that we need to take into account the offset between the pixels, and only care about locations that are inside both patterns.
+    size_t changedPixelIndex = changedPixelY * context.m_outputImageWidth + changedPixelX;
+    size_t affectedPixelIndex = affectedPixelY * context.m_outputImageWidth + affectedPixelX;
+
+    const size_t positionCount = context.m_positionsPerAxis * context.m_positionsPerAxis;
+
+	// Build a mask of the affectedPixel possible patterns that are still supported by the changed pixel's constraints
+	uint64* affectedCell = context.m_wave.Cell(affectedPixelIndex);
+	std::fill(context.m_scratchMask.begin(), context.m_scratchMask.end(), 0);
+	for (size_t wordIndex = 0; wordIndex < context.m_wave.m_wordsPerCell; ++wordIndex)
+	{
+		uint64 word = affectedCell[wordIndex];
+		while (word)
+		{
+			size_t affectedPixelOffset = wordIndex * 64 + CountTrailingZeros(word);
+			word &= word - 1;
+
+			size_t affectedPatternIndex = affectedPixelOffset / positionCount;
+			size_t affectedPatternOffsetPixelIndex = affectedPixelOffset % positionCount;
+
+			size_t affectedPatternOffsetPixelX = affectedPatternOffsetPixelIndex % context.m_positionsPerAxis;
+			size_t affectedPatternOffsetPixelY = affectedPatternOffsetPixelIndex / context.m_positionsPerAxis;
+
+			// Look in the propagator to see if any possible pattern in the changed pixel agrees with this one
+			bool patternOK = PatternSupported(context, context.m_wave.Cell(changedPixelIndex), &context.m_changedPixelPositions[0], affectedPatternIndex, (int)affectedPatternOffsetPixelX, (int)affectedPatternOffsetPixelY, patternOffsetX, patternOffsetY);
+
+			#if VERIFY_PROPAGATOR()
+			{
+				// Loop through the changedPixel possible patterns to see if any match the offset affectedPixel patterns
+				bool patternMatchesOK = false;
+				context.m_patterns.m_pixels.Dispatch(
+					[&] (const auto* patternPixels)
+					{
+						const auto* currentAffectedPixelPattern = patternPixels + affectedPatternIndex * context.m_patterns.m_patternSize;
+						for (size_t changedPixelOffset = 0; changedPixelOffset < context.m_boolsPerPixel && !patternMatchesOK; ++changedPixelOffset)
+						{
+							if (!context.m_wave.Get(changedPixelIndex, changedPixelOffset))
+								continue;
+
+							size_t changedPatternIndex = changedPixelOffset / positionCount;
+							size_t changedPatternOffsetPixelIndex = changedPixelOffset % positionCount;
+
+							int changedPatternOffsetPixelX = (int)(changedPatternOffsetPixelIndex % context.m_positionsPerAxis) + patternOffsetX;
+							int changedPatternOffsetPixelY = (int)(changedPatternOffsetPixelIndex / context.m_positionsPerAxis) + patternOffsetY;
+
+							const auto* currentChangedPixelPattern = patternPixels + changedPatternIndex * context.m_patterns.m_patternSize;
+
+							patternMatchesOK = PatternMatches(currentAffectedPixelPattern, currentChangedPixelPattern, (int)affectedPatternOffsetPixelX, (int)affectedPatternOffsetPixelY, changedPatternOffsetPixelX, changedPatternOffsetPixelY, context.m_tileSize);
+						}
+					}
+				);
+
+				if (patternOK != patternMatchesOK)
+				{
+					fprintf(stderr, "Propagator disagrees with PatternMatches()! changed %zu,%zu affected %zu,%zu pattern %zu offset %zu: propagator %i, PatternMatches %i\n",
+						changedPixelX, changedPixelY, affectedPixelX, affectedPixelY, affectedPatternIndex, affectedPatternOffsetPixelIndex, patternOK, patternMatchesOK);
+				}
+			}
+			#endif
+
+			// if the pattern is ok, keep it
+			if (patternOK)
+				context.m_scratchMask[wordIndex] |= (uint64)1 << (affectedPixelOffset % 64);
+			else
+				TRACE("    disabling pattern %zu, offset %zu\n", affectedPatternIndex, affectedPatternOffsetPixelIndex);
+		}
+	}
+
+	// disable the patterns that weren't ok, and remember that we've changed this affectedPixel if anything was disabled
+	BanPossibilities(context, affectedPixelIndex, &context.m_scratchMask[0]);
+
+	TRACE("  %zu possibilities remaining\n", context.m_cellEntropy[affectedPixelIndex].m_remaining);
+}
+
+void PropagateCompatibilityTable (SContext& context, size_t i)
+{
+	// A pixel with no possibilities left can't support anything. Observe() will report it as a failure.
+	const uint64* changedCell = context.m_wave.Cell(i);
+	if (!WaveAnyBitSet(changedCell, context.m_wave.m_wordsPerCell))
+		return;
+
+	// remember which positions have any pattern possible in the changed pixel, for the patterns that don't overlap
+	const size_t positionCount = context.m_positionsPerAxis * context.m_positionsPerAxis;
+	std::fill(context.m_changedPixelPositions.begin(), context.m_changedPixelPositions.end(), 0);
+	for (size_t wordIndex = 0; wordIndex < context.m_wave.m_wordsPerCell; ++wordIndex)
+	{
+		uint64 word = changedCell[wordIndex];
+		while (word)
+		{
+			context.m_changedPixelPositions[(wordIndex * 64 + CountTrailingZeros(word)) % positionCount] = 1;
+			word &= word - 1;
+		}
+	}
+
+	// Process all pixels that could be affected by a change to this pixel
+	size_t changedPixelX = i % context.m_outputImageWidth;
+	size_t changedPixelY = i / context.m_outputImageWidth;
+	TRACE("propagating changes for pixel %zu,%zu\n", changedPixelX, changedPixelY);
+	for (int indexY = -(int)context.m_tileSize + 1, stopY = (int)context.m_tileSize; indexY < stopY; ++indexY)
+	{
+		for (int indexX = -(int)context.m_tileSize + 1, stopX = (int)context.m_tileSize; indexX < stopX; ++indexX)
+		{
+			// no need to process the same pixel
+			if (indexX == 0 && indexY == 0)
+				continue;
+
+			size_t affectedPixelX, affectedPixelY;
+			if (!GetNeighborPixel(context, changedPixelX, changedPixelY, indexX, indexY, affectedPixelX, affectedPixelY))
+				continue;
+            PropagatePatternRestrictions(context, changedPixelX, changedPixelY, affectedPixelX, affectedPixelY, indexX, indexY);
+		}
+	}
+
+}
+
+void PropagateCompatibilityTableParallel (SContext& context, SPropagationWorker& worker, size_t i)
+{
+	// Same as PropagateCompatibilityTable(), but other workers can be banning possibilities in these pixels at the same time.
+	// Copy the changed pixel so it's consistent while we look at it.  If it loses more possibilities it'll be pushed again.
+	SParallelPropagation& parallel = context.m_parallelPropagation;
+	const size_t wordsPerCell = context.m_wave.m_wordsPerCell;
+	const size_t positionCount = context.m_positionsPerAxis * context.m_positionsPerAxis;
+	uint64* changedCell = context.m_wave.Cell(i);
+	bool anyPossible = false;
+	std::fill(worker.m_changedPixelPositions.begin(), worker.m_changedPixelPositions.end(), 0);
+	for (size_t wordIndex = 0; wordIndex < wordsPerCell; ++wordIndex)
+	{
+		uint64 word = WaveAtomicWord(&changedCell[wordIndex]).load(std::memory_order_relaxed);
+		worker.m_changedCell[wordIndex] = word;
+		anyPossible |= word != 0;
+		while (word)
+		{
+			worker.m_changedPixelPositions[(wordIndex * 64 + CountTrailingZeros(word)) % positionCount] = 1;
+			word &= word - 1;
+		}
+	}
+	if (!anyPossible)
+		return;
+
+	size_t changedPixelX = i % context.m_outputImageWidth;
+	size_t changedPixelY = i / context.m_outputImageWidth;
+	for (int indexY = -(int)context.m_tileSize + 1, stopY = (int)context.m_tileSize; indexY < stopY; ++indexY)
+	{
+		for (int indexX = -(int)context.m_tileSize + 1, stopX = (int)context.m_tileSize; indexX < stopX; ++indexX)
+		{
+			if (indexX == 0 && indexY == 0)
+				continue;
+
+			size_t affectedPixelX, affectedPixelY;
+			if (!GetNeighborPixel(context, changedPixelX, changedPixelY, indexX, indexY, affectedPixelX, affectedPixelY))
+				continue;
+			size_t affectedPixelIndex = affectedPixelY * context.m_outputImageWidth + affectedPixelX;
+			uint64* affectedCell = context.m_wave.Cell(affectedPixelIndex);
+			bool anyBanned = false;
+			for (size_t wordIndex = 0; wordIndex < wordsPerCell; ++wordIndex)
+			{
+				uint64 word = WaveAtomicWord(&affectedCell[wordIndex]).load(std::memory_order_relaxed);
+				uint64 keep = word;
+				while (word)
+				{
+					size_t affectedPixelOffset = wordIndex * 64 + CountTrailingZeros(word);
+					word &= word - 1;
+
+					size_t affectedPositionIndex = affectedPixelOffset % positionCount;
+					int affectedPositionX = (int)(affectedPositionIndex % context.m_positionsPerAxis);
+					int affectedPositionY = (int)(affectedPositionIndex / context.m_positionsPerAxis);
+					if (!PatternSupported(context, &worker.m_changedCell[0], &worker.m_changedPixelPositions[0], affectedPixelOffset / positionCount, affectedPositionX, affectedPositionY, indexX, indexY))
+						keep &= ~((uint64)1 << (affectedPixelOffset % 64));
+				}
+
+				if (keep == WaveAtomicWord(&affectedCell[wordIndex]).load(std::memory_order_relaxed))
+					continue;
+
+				// only the bits we actually cleared count as our bans, another worker may have gotten to some of them first
+				uint64 banned = WaveAtomicWord(&affectedCell[wordIndex]).fetch_and(keep, std::memory_order_relaxed) & ~keep;
+				if (banned)
+				{
+					worker.m_bans.push_back({ (uint32)affectedPixelIndex, (uint32)wordIndex, banned });
+					anyBanned = true;
+				}
+			}
+
+			if (anyBanned)
+				parallel.Push(affectedPixelIndex);
+		}
+	}
+}
+
+// below this many pending pixels, parallel propagation stays on the calling thread
+static const size_t c_minParallelPropagationPixels = 64;
+
+void PropagateAllChangesParallel (SContext& context)
+{
+	// hand the pixels changed since the last propagation to the workers that own them
+	SParallelPropagation& parallel = context.m_parallelPropagation;
+	SPropagationQueue& queue = context.m_propagationQueue;
+	for (const SPropagationEntry& entry : queue.m_entries)
+	{
+		queue.m_queued[entry.m_pixelIndex] = 0;
+		parallel.Push(entry.m_pixelIndex);
+	}
+	queue.m_entries.clear();
+
+	// propagates the pixels just taken off a worker's stack
+	auto propagatePixels = [&] (SPropagationWorker& worker)
+	{
+		for (uint32 pixelIndex : worker.m_pixels)
+		{
+			// clear the flag first, so a ban that happens while we're working on the pixel queues it again
+			parallel.m_queued[pixelIndex].exchange(0, std::memory_order_acq_rel);
+			PropagateCompatibilityTableParallel(context, worker, pixelIndex);
+			++worker.m_pops;
+			PROFILE_COUNT(e_queuePops, 1);
+			parallel.m_pending.fetch_sub(1, std::memory_order_acq_rel);
+		}
+	};
+
+	// A cascade usually starts from the one observed pixel, and many stay small, which isn't worth waking the pool for.  This
+	// thread works through every worker's stack until enough pixels are pending to share out.  The bans are the same either way.
+	while (1)
+	{
+		const size_t pending = parallel.m_pending.load(std::memory_order_acquire);
+		if (pending == 0 || parallel.m_workers.size() == 1 || pending >= c_minParallelPropagationPixels)
+			break;
+		for (SPropagationWorker& worker : parallel.m_workers)
+		{
+			if (parallel.TakeAll(worker))
+				propagatePixels(worker);
+		}
+	}
+
+	// each worker propagates the pixels in it's stack on it's own thread until nothing is pending anywhere
+	if (parallel.m_pending.load(std::memory_order_acquire) > 0)
+	{
+		parallel.m_pool.Run(
+			[&] (size_t workerIndex)
+			{
+				PROFILE_SCOPE("PropagationWorker");
+				SPropagationWorker& worker = parallel.m_workers[workerIndex];
+				while (1)
+				{
+					if (parallel.TakeAll(worker))
+						propagatePixels(worker);
+					else if (parallel.m_pending.load(std::memory_order_acquire) == 0)
+						break;
+					else
+						std::this_thread::yield();
+				}
+			}
+		);
+	}
+
+	// Now that the workers are done, take the bans out of the entropy totals and update the heap.  They are sorted first so that the
+	// totals come out the same no matter how the work was split up.
+	parallel.m_bans.clear();
+	for (SPropagationWorker& worker : parallel.m_workers)
+	{
+		parallel.m_bans.insert(parallel.m_bans.end(), worker.m_bans.begin(), worker.m_bans.end());
+		worker.m_bans.clear();
+		queue.m_pops += worker.m_pops;
+		worker.m_pops = 0;
+	}
+	std::sort(parallel.m_bans.begin(), parallel.m_bans.end());
+	for (size_t banIndex = 0; banIndex < parallel.m_bans.size(); ++banIndex)
+	{
+		const SParallelBan& ban = parallel.m_bans[banIndex];
+		for (uint64 bits = ban.m_bits; bits; bits &= bits - 1)
+			RemoveFromEntropyTotals(context, ban.m_pixelIndex, ban.m_wordIndex * 64 + CountTrailingZeros(bits));
+		if (banIndex + 1 == parallel.m_bans.size() || parallel.m_bans[banIndex + 1].m_pixelIndex != ban.m_pixelIndex)
+			context.m_entropyHeap.Update(ban.m_pixelIndex, CellEntropyKey(context.m_cellEntropy[ban.m_pixelIndex], context.m_entropyHeuristic));
+	}
+}
+
+void PropagateSupportCounters (SContext& context, const SPropagationEntry& entry)
+{
+	// Every possibility that the banned possibility supported in each neighbor loses a support from that direction.
+	// When a possibility has no supports left from some direction, it is impossible, so gets banned and queued in turn.
+	const size_t positionCount = context.m_positionsPerAxis * context.m_positionsPerAxis;
+	const size_t changedPosition = entry.m_possibility % positionCount;
+	size_t changedPixelX = entry.m_pixelIndex % context.m_outputImageWidth;
+	size_t changedPixelY = entry.m_pixelIndex / context.m_outputImageWidth;
+	size_t neighborOffset = 0;
+	for (int indexY = -(int)context.m_tileSize + 1, stopY = (int)context.m_tileSize; indexY < stopY; ++indexY)
+	{
+		for (int indexX = -(int)context.m_tileSize + 1, stopX = (int)context.m_tileSize; indexX < stopX; ++indexX)
+		{
+			if (indexX == 0 && indexY == 0)
+				continue;
+
+			// pixels off the edge of a non periodic output don't take supports away from anything
+			size_t affectedPixelX, affectedPixelY;
+			if (!GetNeighborPixel(context, changedPixelX, changedPixelY, indexX, indexY, affectedPixelX, affectedPixelY))
+			{
+				++neighborOffset;
+				continue;
+			}
+			size_t affectedPixelIndex = affectedPixelY * context.m_outputImageWidth + affectedPixelX;
+			uint32* supportCounts = &context.m_supportCounts[(affectedPixelIndex * context.m_numNeighborOffsets + neighborOffset) * context.m_boolsPerPixel];
+			uint32* positionSupportCounts = &context.m_positionSupportCounts[(affectedPixelIndex * context.m_numNeighborOffsets + neighborOffset) * positionCount];
+			auto banIfUnsupported = [&] (size_t affectedPossibility)
+			{
+				if (supportCounts[affectedPossibility] == 0 && positionSupportCounts[affectedPossibility % positionCount] == 0 && context.m_wave.Get(affectedPixelIndex, affectedPossibility))
+				{
+					TRACE("    pixel %zu,%zu disabling pattern %zu, offset %zu\n", affectedPixelX, affectedPixelY, affectedPossibility / positionCount, affectedPossibility % positionCount);
+					BanPossibility(context, affectedPixelIndex, affectedPossibility);
+				}
+			};
+
+			// the overlapping patterns that agreed with the banned one lose a support
+			ForEachSupportedPossibility(context, entry.m_possibility, indexX, indexY,
+				[&] (size_t affectedPossibility)
+				{
+					--supportCounts[affectedPossibility];
+					banIfUnsupported(affectedPossibility);
+				}
+			);
+
+			// if this pixel has no patterns left at this position, every pattern that didn't overlap it loses a supporting position
+			if (entry.m_emptiedPosition)
+			{
+				ForEachNonOverlappingPosition(context, changedPosition, indexX, indexY,
+					[&] (size_t affectedPosition)
+					{
+						if (--positionSupportCounts[affectedPosition] != 0)
+							return;
+						for (size_t affectedPossibility = affectedPosition; affectedPossibility < context.m_boolsPerPixel; affectedPossibility += positionCount)
+							banIfUnsupported(affectedPossibility);
+					}
+				);
+			}
+
+			++neighborOffset;
+		}
+	}
+}
+
+void RestoreSupportCounters (SContext& context, const SPropagationEntry& entry)
+{
+	// gives back the supports that PropagateSupportCounters() took away when it propagated this ban
+	const size_t positionCount = context.m_positionsPerAxis * context.m_positionsPerAxis;
+	const size_t changedPosition = entry.m_possibility % positionCount;
+	size_t changedPixelX = entry.m_pixelIndex % context.m_outputImageWidth;
+	size_t changedPixelY = entry.m_pixelIndex / context.m_outputImageWidth;
+	size_t neighborOffset = 0;
+	for (int indexY = -(int)context.m_tileSize + 1, stopY = (int)context.m_tileSize; indexY < stopY; ++indexY)
+	{
+		for (int indexX = -(int)context.m_tileSize + 1, stopX = (int)context.m_tileSize; indexX < stopX; ++indexX)
+		{
+			if (indexX == 0 && indexY == 0)
+				continue;
+
+			// pixels off the edge of a non periodic output don't take supports away from anything
+			size_t affectedPixelX, affectedPixelY;
+			if (!GetNeighborPixel(context, changedPixelX, changedPixelY, indexX, indexY, affectedPixelX, affectedPixelY))
+			{
+				++neighborOffset;
+				continue;
+			}
+			size_t affectedPixelIndex = affectedPixelY * context.m_outputImageWidth + affectedPixelX;
+			uint32* supportCounts = &context.m_supportCounts[(affectedPixelIndex * context.m_numNeighborOffsets + neighborOffset) * context.m_boolsPerPixel];
+			uint32* positionSupportCounts = &context.m_positionSupportCounts[(affectedPixelIndex * context.m_numNeighborOffsets + neighborOffset) * positionCount];
+
+			ForEachSupportedPossibility(context, entry.m_possibility, indexX, indexY,
+				[&] (size_t affectedPossibility)
+				{
+					++supportCounts[affectedPossibility];
+				}
+			);
+
+			if (entry.m_emptiedPosition)
+			{
+				ForEachNonOverlappingPosition(context, changedPosition, indexX, indexY,
+					[&] (size_t affectedPosition)
+					{
+						++positionSupportCounts[affectedPosition];
+					}
+				);
+			}
+
+			++neighborOffset;
+		}
+	}
+}
+
+#if VERIFY_PROPAGATOR()
+void VerifySupportCounters (SContext& context)
+{
+	// once the support counters have finished propagating, re-checking every pixel against every neighbor with the compatibility
+	// table shouldn't find anything else to ban
+	const size_t positionCount = context.m_positionsPerAxis * context.m_positionsPerAxis;
+	for (size_t pixelIndex = 0; pixelIndex < context.m_numPixels; ++pixelIndex)
+	{
+		std::vector<uint64> before(context.m_wave.m_words.begin(), context.m_wave.m_words.end());
+		PropagateCompatibilityTable(context, pixelIndex);
+		if (!std::equal(before.begin(), before.end(), context.m_wave.m_words.begin()))
+			fprintf(stderr, "Support counters missed a ban next to pixel %zu,%zu!\n", pixelIndex % context.m_outputImageWidth, pixelIndex / context.m_outputImageWidth);
+	}
+	context.m_propagationQueue.m_entries.clear();
+}
+#endif
+
+// The simple tiled model's engine: each neighbor of the changed pixel keeps only the tiles that one of the changed pixel's tiles allows
+// next to it on that side
+void PropagateTileAdjacency (SContext& context, size_t i)
+{
+	// a pixel with nothing left is a contradiction that Observe() will find, and it doesn't allow anything
+	const size_t wordsPerCell = context.m_wave.m_wordsPerCell;
+	const uint64* changedCell = context.m_wave.Cell(i);
+	if (!WaveAnyBitSet(changedCell, wordsPerCell))
+		return;
+
+	const STileAdjacency& adjacency = context.m_model.m_tileAdjacency;
+	uint64* allowed = &context.m_scratchMask[0];
+	const size_t changedX = i % context.m_outputImageWidth;
+	const size_t changedY = i / context.m_outputImageWidth;
+	for (size_t direction = 0; direction < c_numTileDirections; ++direction)
+	{
+		size_t neighborX, neighborY;
+		if (!GetNeighborPixel(context, changedX, changedY, c_tileDirectionOffsets[direction][0], c_tileDirectionOffsets[direction][1], neighborX, neighborY))
+			continue;
+
+		std::fill(allowed, allowed + wordsPerCell, 0);
+		for (size_t wordIndex = 0; wordIndex < wordsPerCell; ++wordIndex)
+		{
+			for (uint64 word = changedCell[wordIndex]; word; word &= word - 1)
+				WaveOrMask(allowed, adjacency.Allowed(direction, wordIndex * 64 + CountTrailingZeros(word)), wordsPerCell);
+		}
+		BanPossibilities(context, neighborY * context.m_outputImageWidth + neighborX, allowed);
+	}
+}
+
+bool Propagate (SContext& context)
+{
+	// get a changed pixel.  If none left, return false.
+	if (context.m_propagationQueue.Empty())
+		return false;
+	SPropagationEntry entry = context.m_propagationQueue.Pop();
+
+	if (context.m_propagationEngine == EPropagationEngine::e_tileAdjacency)
+	{
+		PropagateTileAdjacency(context, entry.m_pixelIndex);
+		return true;
+	}
+
+	if (context.m_propagationEngine == EPropagationEngine::e_supportCounters)
+	{
+		if (context.m_undoLog.Recording())
+			context.m_undoLog.m_propagated.push_back(entry);
+		PropagateSupportCounters(context, entry);
+	}
+	else
+		PropagateCompatibilityTable(context, entry.m_pixelIndex);
+
+	// return that we did do some work
+	return true;
+}
+
+// Sets up the propagation queue and scratch space for the context's propagation engine
+void InitializePropagation (SContext& context)
+{
+	const size_t positionCount = context.m_positionsPerAxis * context.m_positionsPerAxis;
+	context.m_scratchMask.assign(context.m_wave.m_wordsPerCell, 0);
+	context.m_changedPixelPositions.assign(positionCount, 0);
+
+	// initialize which pixels have been changed - starting with none
+	context.m_propagationQueue.Init(context.m_numPixels, context.m_propagationEngine != EPropagationEngine::e_supportCounters);
+	if (context.m_propagationEngine == EPropagationEngine::e_parallelCompatibilityTable)
+		context.m_parallelPropagation.Init(context.m_outputImageWidth, context.m_outputImageHeight, context.m_numThreads, context.m_wave.m_wordsPerCell, positionCount);
+}
+
+void InitializeWave (SContext& context)
+{
+	PROFILE_SCOPE("InitializeWave");
+	context.m_wave.Init(context.m_numPixels, context.m_boolsPerPixel);
+
+	// the simple tiled model has no propagator, only adjacency
+	if (context.m_model.m_type == EModelType::e_simpleTiled)
+		context.m_propagationEngine = EPropagationEngine::e_tileAdjacency;
+
+	// each bit is weighted by the count of the pattern it belongs to. Padding bits get a weight of zero.
+	const size_t positionCount = context.m_positionsPerAxis * context.m_positionsPerAxis;
+	SCellEntropy fullCell = { 0, 0, context.m_boolsPerPixel };
+	context.m_possibilityWeights.assign(context.m_wave.m_wordsPerCell * 64, 0);
+	context.m_possibilityWeightLogWeights.assign(context.m_wave.m_wordsPerCell * 64, 0);
+	for (size_t bit = 0; bit < context.m_boolsPerPixel; ++bit)
+	{
+		uint64 weight = context.m_patterns.Count(bit / positionCount);
+		context.m_possibilityWeights[bit] = weight;
+		context.m_possibilityWeightLogWeights[bit] = WeightLogWeight(weight);
+		fullCell.m_sumWeights += weight;
+		fullCell.m_sumWeightLogWeights += context.m_possibilityWeightLogWeights[bit];
+	}
+
+	// every pixel starts out with every possibility, so they all have the same entropy
+	context.m_cellEntropy.assign(context.m_numPixels, fullCell);
+	context.m_entropyHeap.Init(context.m_numPixels, CellEntropyKey(fullCell, context.m_entropyHeuristic));
+
+	InitializePropagation(context);
+	if (context.m_propagationEngine == EPropagationEngine::e_tileAdjacency)
+	{
+		// a tile that allows nothing next to it on some side can't be in a pixel that has a neighbor on that side
+		const STileAdjacency& adjacency = context.m_model.m_tileAdjacency;
+		for (size_t tile = 0; tile < context.m_boolsPerPixel; ++tile)
+		{
+			for (size_t direction = 0; direction < c_numTileDirections; ++direction)
+			{
+				if (WaveAnyBitSet(adjacency.Allowed(direction, tile), context.m_wave.m_wordsPerCell))
+					continue;
+				for (size_t pixelIndex = 0; pixelIndex < context.m_numPixels; ++pixelIndex)
+				{
+					size_t neighborX, neighborY;
+					if (context.m_wave.Get(pixelIndex, tile) && GetNeighborPixel(context, pixelIndex % context.m_outputImageWidth, pixelIndex / context.m_outputImageWidth,
+						c_tileDirectionOffsets[direction][0], c_tileDirectionOffsets[direction][1], neighborX, neighborY))
+						BanPossibility(context, pixelIndex, tile);
+				}
+			}
+		}
+		return;
+	}
+	if (context.m_propagationEngine != EPropagationEngine::e_supportCounters)
+		return;
+
+	// Every pixel starts out with every possibility, so every pixel starts with the same support counts.  Count them once by seeing
+	// what each possibility supports in each direction, and copy that to every pixel.
+	context.m_numNeighborOffsets = (context.m_tileSize * 2 - 1) * (context.m_tileSize * 2 - 1) - 1;
+	context.m_initialSupportCounts.assign(context.m_numNeighborOffsets * context.m_boolsPerPixel, 0);
+	context.m_initialPositionSupportCounts.assign(context.m_numNeighborOffsets * positionCount, 0);
+	size_t neighborOffset = 0;
+	for (int indexY = -(int)context.m_tileSize + 1, stopY = (int)context.m_tileSize; indexY < stopY; ++indexY)
+	{
+		for (int indexX = -(int)context.m_tileSize + 1, stopX = (int)context.m_tileSize; indexX < stopX; ++indexX)
+		{
+			if (indexX == 0 && indexY == 0)
+				continue;
+
+			uint32* supportCounts = &context.m_initialSupportCounts[neighborOffset * context.m_boolsPerPixel];
+			for (size_t possibility = 0; possibility < context.m_boolsPerPixel; ++possibility)
+				ForEachSupportedPossibility(context, possibility, indexX, indexY, [supportCounts] (size_t supported) { ++supportCounts[supported]; });
+
+			uint32* positionSupportCounts = &context.m_initialPositionSupportCounts[neighborOffset * positionCount];
+			for (size_t position = 0; position < positionCount; ++position)
+				ForEachNonOverlappingPosition(context, position, indexX, indexY, [positionSupportCounts] (size_t supported) { ++positionSupportCounts[supported]; });
+			++neighborOffset;
+		}
+	}
+
+	context.m_supportCounts.resize(context.m_numPixels * context.m_initialSupportCounts.size());
+	context.m_positionSupportCounts.resize(context.m_numPixels * context.m_initialPositionSupportCounts.size());
+	for (size_t pixelIndex = 0; pixelIndex < context.m_numPixels; ++pixelIndex)
+	{
+		std::copy(context.m_initialSupportCounts.begin(), context.m_initialSupportCounts.end(), context.m_supportCounts.begin() + pixelIndex * context.m_initialSupportCounts.size());
+		std::copy(context.m_initialPositionSupportCounts.begin(), context.m_initialPositionSupportCounts.end(), context.m_positionSupportCounts.begin() + pixelIndex * context.m_initialPositionSupportCounts.size());
+	}
+	context.m_positionCounts.assign(context.m_numPixels * positionCount, (uint32)context.m_patterns.Size());
+
+	// a possibility with no support from some direction can never happen in a pixel that has a neighbor in that direction, so ban it
+	// there up front.  If the output is periodic, that's every pixel.  The supports at an offset come from the pixel at minus that offset.
+	std::vector<std::pair<int, int>> unsupportedOffsets;
+	for (size_t possibility = 0; possibility < context.m_boolsPerPixel; ++possibility)
+	{
+		unsupportedOffsets.clear();
+		neighborOffset = 0;
+		for (int indexY = -(int)context.m_tileSize + 1, stopY = (int)context.m_tileSize; indexY < stopY; ++indexY)
+		{
+			for (int indexX = -(int)context.m_tileSize + 1, stopX = (int)context.m_tileSize; indexX < stopX; ++indexX)
+			{
+				if (indexX == 0 && indexY == 0)
+					continue;
+				if (context.m_initialSupportCounts[neighborOffset * context.m_boolsPerPixel + possibility] == 0 &&
+					context.m_initialPositionSupportCounts[neighborOffset * positionCount + possibility % positionCount] == 0)
+					unsupportedOffsets.push_back(std::make_pair(-indexX, -indexY));
+				++neighborOffset;
+			}
+		}
+
+		for (size_t pixelIndex = 0; pixelIndex < context.m_numPixels && !unsupportedOffsets.empty(); ++pixelIndex)
+		{
+			for (const std::pair<int, int>& offset : unsupportedOffsets)
+			{
+				size_t neighborX, neighborY;
+				if (GetNeighborPixel(context, pixelIndex % context.m_outputImageWidth, pixelIndex / context.m_outputImageWidth, offset.first, offset.second, neighborX, neighborY))
+				{
+					BanPossibility(context, pixelIndex, possibility);
+					break;
+				}
+			}
+		}
+	}
+}
+
+void PropagateAllChanges (SContext& context)
+{
+	PROFILE_SCOPE("PropagateAllChanges");
+	// Propagate until no progress can be made
+	TClock::time_point start = TClock::now();
+	if (context.m_propagationEngine == EPropagationEngine::e_parallelCompatibilityTable)
+		PropagateAllChangesParallel(context);
+	else
+		while (Propagate(context));
+	#if VERIFY_PROPAGATOR()
+	if (context.m_propagationEngine == EPropagationEngine::e_supportCounters)
+		VerifySupportCounters(context);
+	#endif
+	context.m_propagationQueue.m_seconds += SecondsSince(start);
+}
+
+void UndoDecisions (SContext& context, size_t decisionIndex)
+{
+	PROFILE_SCOPE("UndoDecisions");
+	// puts everything back how it was just before decision decisionIndex was made, newest change first
+	SUndoLog& undoLog = context.m_undoLog;
+	const SDecision& decision = undoLog.m_decisions[decisionIndex];
+	const size_t positionCount = context.m_positionsPerAxis * context.m_positionsPerAxis;
+
+	for (size_t index = undoLog.m_propagated.size(); index > decision.m_propagatedMark; --index)
+		RestoreSupportCounters(context, undoLog.m_propagated[index - 1]);
+
+	for (size_t index = undoLog.m_bans.size(); index > decision.m_bansMark; --index)
+	{
+		const SUndoBan& ban = undoLog.m_bans[index - 1];
+		context.m_wave.Cell(ban.m_pixelIndex)[ban.m_possibility / 64] |= (uint64)1 << (ban.m_possibility % 64);
+		if (context.m_propagationEngine == EPropagationEngine::e_supportCounters)
+			++context.m_positionCounts[ban.m_pixelIndex * positionCount + ban.m_possibility % positionCount];
+	}
+
+	for (size_t index = decisionIndex; index < undoLog.m_decisions.size(); ++index)
+	{
+		const size_t pixelIndex = undoLog.m_decisions[index].m_pixelIndex;
+		context.m_observedPixels.Clear(pixelIndex);
+		if (context.m_streamWriter)
+			++context.m_rowUndecidedPixels[pixelIndex / context.m_outputImageWidth];
+	}
+
+	for (size_t index = undoLog.m_cellEntropies.size(); index > decision.m_cellEntropiesMark; --index)
+	{
+		const SUndoCellEntropy& saved = undoLog.m_cellEntropies[index - 1];
+		context.m_cellEntropy[saved.m_pixelIndex] = saved.m_cellEntropy;
+	}
+
+	// the restored cells get their old keys back, and the undone decisions go back in the heap as undecided.  Decided pixels that were
+	// only in the heap because they had emptied come back out.
+	for (size_t index = decision.m_cellEntropiesMark; index < undoLog.m_cellEntropies.size(); ++index)
+	{
+		const size_t pixelIndex = undoLog.m_cellEntropies[index].m_pixelIndex;
+		if (context.m_observedPixels.m_patterns.Get(pixelIndex) != context.m_observedPixels.m_patterns.None())
+		{
+			if (context.m_entropyHeap.Contains(pixelIndex))
+				context.m_entropyHeap.Remove(pixelIndex);
+		}
+		else
+			context.m_entropyHeap.Update(pixelIndex, CellEntropyKey(context.m_cellEntropy[pixelIndex], context.m_entropyHeuristic));
+	}
+	for (size_t index = decisionIndex; index < undoLog.m_decisions.size(); ++index)
+	{
+		const size_t pixelIndex = undoLog.m_decisions[index].m_pixelIndex;
+		if (!context.m_entropyHeap.Contains(pixelIndex))
+			context.m_entropyHeap.Push(pixelIndex, CellEntropyKey(context.m_cellEntropy[pixelIndex], context.m_entropyHeuristic));
+	}
+
+	undoLog.m_restoredBytes += (undoLog.m_decisions.size() - decisionIndex) * sizeof(SDecision) +
+		(undoLog.m_bans.size() - decision.m_bansMark) * sizeof(SUndoBan) +
+		(undoLog.m_propagated.size() - decision.m_propagatedMark) * sizeof(SPropagationEntry) +
+		(undoLog.m_cellEntropies.size() - decision.m_cellEntropiesMark) * sizeof(SUndoCellEntropy);
+
+	undoLog.m_bans.resize(decision.m_bansMark);
+	undoLog.m_propagated.resize(decision.m_propagatedMark);
+	undoLog.m_cellEntropies.resize(decision.m_cellEntropiesMark);
+	undoLog.m_decisions.resize(decisionIndex);
+	++undoLog.m_epoch;
+
+	// anything still waiting to propagate came from the undone decisions
+	context.m_propagationQueue.Clear();
+}
+
+// Called on a contradiction.  Undoes the last m_backjump decisions and bans the oldest one's choice, so the solver tries something else
+// there.  Returns false if there is nothing left to undo, or it has already backtracked too many times.
+bool Backtrack (SContext& context)
+{
+	PROFILE_SCOPE("Backtrack");
+	SUndoLog& undoLog = context.m_undoLog;
+	if (undoLog.m_decisions.empty() || undoLog.m_backtracks >= undoLog.m_maxBacktracks)
+		return false;
+	++undoLog.m_backtracks;
+
+	const size_t decisionIndex = undoLog.m_decisions.size() - std::min(std::max<size_t>(1, undoLog.m_backjump), undoLog.m_decisions.size());
+	const SDecision decision = undoLog.m_decisions[decisionIndex];
+	TRACE("%s(): undoing %zu decisions, banning pixel %zu,%zu possibility %zu\n", __FUNCTION__, undoLog.m_decisions.size() - decisionIndex, decision.m_pixelIndex % context.m_outputImageWidth, decision.m_pixelIndex / context.m_outputImageWidth, decision.m_possibility);
+	UndoDecisions(context, decisionIndex);
+	BanPossibility(context, decision.m_pixelIndex, decision.m_possibility);
+	return true;
+}
+
+void ReportPropagationScaling (SContext& context)
+{
+	// Time the parallel engine propagating one big burst of bans on a large output: observe a grid of pixels all at once, then
+	// propagate with every thread count from 1 up to the number of hardware threads.  They should all end up with the same wave, unless
+	// the observations contradicted each other.  Pixels with no possibilities left don't propagate, so then it depends on timing.
+	const size_t outputImageWidth = context.m_outputImageWidth;
+	const size_t outputImageHeight = context.m_outputImageHeight;
+	const size_t numThreads = context.m_numThreads;
+	const EPropagationEngine propagationEngine = context.m_propagationEngine;
+	const SPRNG prng = context.m_prng;
+	const size_t maxUndoDepth = context.m_undoLog.m_maxDepth;
+	context.m_undoLog.m_maxDepth = 0;
+	context.m_outputImageWidth = 128;
+	context.m_outputImageHeight = 128;
+	context.m_numPixels = context.m_outputImageWidth * context.m_outputImageHeight;
+	context.m_propagationEngine = EPropagationEngine::e_parallelCompatibilityTable;
+
+	TWaveWords firstWave;
+	double baseSeconds = 0.0;
+	printf("Parallel propagation scaling, %zu x %zu output, N = %zu\n", context.m_outputImageWidth, context.m_outputImageHeight, context.m_tileSize);
+	for (size_t threads = 1; threads <= GetDefaultThreadCount(); ++threads)
+	{
+		context.m_numThreads = threads;
+		context.m_prng = SPRNG(0);
+		InitializeWave(context);
+		context.m_observedPixels.Init(context.m_numPixels, context.m_palletizedImage.m_pallete.size(), context.m_patterns.Size(), context.m_positionsPerAxis * context.m_positionsPerAxis);
+		PropagateAllChanges(context);
+		for (size_t y = 0; y < context.m_outputImageHeight; y += 8)
+		{
+			for (size_t x = 0; x < context.m_outputImageWidth; x += 8)
+			{
+				size_t pixelIndex = y * context.m_outputImageWidth + x;
+				if (context.m_cellEntropy[pixelIndex].m_remaining > 0)
+					ObservePixel(context, pixelIndex);
+			}
+		}
+
+		uint64 popsBefore = context.m_propagationQueue.m_pops;
+		TClock::time_point start = TClock::now();
+		PropagateAllChanges(context);
+		double seconds = SecondsSince(start);
+		if (threads == 1)
+		{
+			baseSeconds = seconds;
+			firstWave = context.m_wave.m_words;
+		}
+		bool contradiction = false;
+		for (const SCellEntropy& cellEntropy : context.m_cellEntropy)
+			contradiction |= cellEntropy.m_remaining == 0;
+		printf("  %2zu threads: %8.3f ms, %llu pixels propagated, speedup %0.2fx%s\n", threads, seconds * 1000.0, (unsigned long long)(context.m_propagationQueue.m_pops - popsBefore),
+			baseSeconds / seconds, contradiction ? ", contradiction" : (context.m_wave.m_words == firstWave ? "" : ", DIFFERENT RESULT!"));
+	}
+
+	context.m_outputImageWidth = outputImageWidth;
+	context.m_outputImageHeight = outputImageHeight;
+	context.m_numPixels = context.m_outputImageWidth * context.m_outputImageHeight;
+	context.m_numThreads = numThreads;
+	context.m_propagationEngine = propagationEngine;
+	context.m_prng = prng;
+	context.m_propagationQueue = SPropagationQueue();
+	context.m_undoLog.m_maxDepth = maxUndoDepth;
+}
+
+// Returns false if the image couldn't be written
+bool SaveObservedImage (const SContext& context, const char* fileName)
+{
+	PROFILE_SCOPE("SaveObservedImage");
+	SImageFileWriter writer;
+	const size_t pixelsPerPixel = OutputPixelsPerPixel(context.m_model);
+	if (!writer.Open(fileName, context.m_outputImageWidth * pixelsPerPixel, context.m_outputImageHeight * pixelsPerPixel))
+	{
+		fprintf(stderr, "Could not write image: %s\n", fileName);
+		return false;
+	}
+
+	// write the output image pixels a row at a time, based on the observed colors, or the observed tiles for the simple tiled model.
+	// Undecided pixels, which a failed solve leaves behind, are black.
+	std::vector<SPixel> row(context.m_outputImageWidth * pixelsPerPixel);
+	if (context.m_model.m_type == EModelType::e_simpleTiled)
+	{
+		for (size_t y = 0; y < context.m_outputImageHeight; ++y)
+		{
+			for (size_t tileY = 0; tileY < context.m_tileSize; ++tileY)
+			{
+				GetTileRow(context, y, tileY, &row[0]);
+				writer.WriteRow(y * context.m_tileSize + tileY, &row[0]);
+			}
+		}
+	}
+	else
+	{
+		const uint32 undecided = context.m_observedPixels.m_colors.None();
+		context.m_observedPixels.m_colors.Dispatch(
+			[&] (const auto* srcPixel)
+			{
+				for (size_t y = 0; y < context.m_outputImageHeight; ++y)
+				{
+					for (size_t x = 0; x < context.m_outputImageWidth; ++x, ++srcPixel)
+						row[x] = *srcPixel == undecided ? SPixel{ 0, 0, 0 } : context.m_palletizedImage.m_pallete[*srcPixel];
+					writer.WriteRow(y, &row[0]);
+				}
+			}
+		);
+	}
+
+	if (!writer.Close())
+	{
+		fprintf(stderr, "Could not write image: %s\n", fileName);
+		return false;
+	}
+	return true;
+}
+
+bool SaveFinalImage (const SContext& context)
+{
+	char fileName[256];
+	strcpy(fileName, context.m_model.m_fileName.c_str());
+	strcat(fileName, ".out.bmp");
+	return SaveObservedImage(context, fileName);
+}
+
+
+
+// Pins the pixel at (x, y) to the pattern whose top left corner is there
+void PinPattern (SContext& context, size_t x, size_t y, size_t patternIndex)
+{
+	context.m_pinnedPixels.push_back({ y * context.m_outputImageWidth + x, patternIndex * context.m_positionsPerAxis * context.m_positionsPerAxis });
+}
+
+// Pins the pixel at (x, y) to a pallete color, leaving which pattern gives it that color to the solve
+void PinColor (SContext& context, size_t x, size_t y, uint32 color)
+{
+	context.m_pinnedColors.push_back({ y * context.m_outputImageWidth + x, color });
+}
+
+// Bans every possibility that doesn't have it's pixel's pinned color, then decides the pinned pixels, so everything else has to agree
+// with them.  Returns false if a pinned pixel's possibility is already gone.
+bool ApplyPins (SContext& context)
+{
+	for (const SPinnedColor& pinnedColor : context.m_pinnedColors)
+	{
+		std::fill(context.m_scratchMask.begin(), context.m_scratchMask.end(), 0);
+		for (size_t possibility = 0; possibility < context.m_boolsPerPixel; ++possibility)
+		{
+			if (PossibilityColor(context, possibility) == pinnedColor.m_color)
+				context.m_scratchMask[possibility / 64] |= (uint64)1 << (possibility % 64);
+		}
+		BanPossibilities(context, pinnedColor.m_pixelIndex, &context.m_scratchMask[0]);
+	}
+
+	for (const SPinnedPixel& pinnedPixel : context.m_pinnedPixels)
+	{
+		if (!context.m_wave.Get(pinnedPixel.m_pixelIndex, pinnedPixel.m_possibility))
+			return false;
+		DecidePixel(context, pinnedPixel.m_pixelIndex, pinnedPixel.m_possibility);
+	}
+	return true;
+}
+
+// Sets up the context's wave, propagates it's pins as far as they go, and saves the result to state for Run() to start from.  Returns
+// false if the pins contradict each other, in which case every solve from them would fail.
+bool SaveInitialState (SContext& context, SInitialState& state)
+{
+	PROFILE_SCOPE("SaveInitialState");
+	// pinned pixels are decided once here, not by every solve, so nothing gets streamed
+	SImageStreamWriter* streamWriter = context.m_streamWriter;
+	context.m_streamWriter = nullptr;
+	InitializeWave(context);
+	context.m_observedPixels.Init(context.m_numPixels, context.m_palletizedImage.m_pallete.size(), context.m_patterns.Size(), context.m_positionsPerAxis * context.m_positionsPerAxis);
+	context.m_undoLog.Init(context.m_numPixels);
+	state.m_pinned = ApplyPins(context);
+	PropagateAllChanges(context);
+	context.m_streamWriter = streamWriter;
+
+	state.m_propagationEngine = context.m_propagationEngine;
+	state.m_outputImageWidth = context.m_outputImageWidth;
+	state.m_outputImageHeight = context.m_outputImageHeight;
+	state.m_periodicOutput = context.m_periodicOutput;
+	state.m_wave = context.m_wave;
+	state.m_possibilityWeights = context.m_possibilityWeights;
+	state.m_possibilityWeightLogWeights = context.m_possibilityWeightLogWeights;
+	state.m_cellEntropy = context.m_cellEntropy;
+	state.m_entropyHeap = context.m_entropyHeap;
+	state.m_numNeighborOffsets = context.m_numNeighborOffsets;
+	state.m_supportCounts = context.m_supportCounts;
+	state.m_positionSupportCounts = context.m_positionSupportCounts;
+	state.m_positionCounts = context.m_positionCounts;
+	state.m_observedPixels = context.m_observedPixels;
+
+	// a pixel with nothing left sorts to the top of the heap
+	return state.m_pinned && (context.m_entropyHeap.Empty() || context.m_cellEntropy[context.m_entropyHeap.Top()].m_remaining > 0);
+}
+
+// Copies the initial state into the context.  The copies reuse the context's buffers, so after the first solve this is just copying
+// memory.  Returns false if the state was made for a different output.
+bool RestoreInitialState (SContext& context, const SInitialState& state)
+{
+	PROFILE_SCOPE("RestoreInitialState");
+	if (state.m_outputImageWidth != context.m_outputImageWidth || state.m_outputImageHeight != context.m_outputImageHeight || state.m_periodicOutput != context.m_periodicOutput)
+		return false;
+
+	context.m_propagationEngine = state.m_propagationEngine;
+	context.m_wave = state.m_wave;
+	context.m_possibilityWeights = state.m_possibilityWeights;
+	context.m_possibilityWeightLogWeights = state.m_possibilityWeightLogWeights;
+	context.m_cellEntropy = state.m_cellEntropy;
+	context.m_entropyHeap = state.m_entropyHeap;
+	context.m_numNeighborOffsets = state.m_numNeighborOffsets;
+	context.m_supportCounts = state.m_supportCounts;
+	context.m_positionSupportCounts = state.m_positionSupportCounts;
+	context.m_positionCounts = state.m_positionCounts;
+	context.m_observedPixels = state.m_observedPixels;
+	InitializePropagation(context);
+	return true;
+}
+
+// Solves the context's output image.  Returns e_success or e_failure, or e_notDone if cancel got set before it finished.
+EObserveResult Run (SContext& context, const std::atomic<bool>* cancel, bool reportProgress)
+{
+	// initialize our superpositional pixel information which describes which patterns in what positions each pixel has as a possibility,
+	// and our observed colors for each pixel, which start out as undecided.  An initial state has that with the pins already propagated.
+	// TODO: make this stuff happen in the context constructor
+	TClock::time_point initializeStart = TClock::now();
+	const bool restored = context.m_initialState && RestoreInitialState(context, *context.m_initialState);
+	if (!restored)
+	{
+		InitializeWave(context);
+		context.m_observedPixels.Init(context.m_numPixels, context.m_palletizedImage.m_pallete.size(), context.m_patterns.Size(), context.m_positionsPerAxis * context.m_positionsPerAxis);
+	}
+
+	// rows that the initial state already finished won't be decided again, so they go out now
+	if (context.m_streamWriter)
+	{
+		const SIndexArray& patterns = context.m_observedPixels.m_patterns;
+		context.m_rowUndecidedPixels.assign(context.m_outputImageHeight, 0);
+		context.m_streamRow.resize(context.m_outputImageWidth * OutputPixelsPerPixel(context.m_model));
+		for (size_t pixelIndex = 0; pixelIndex < context.m_numPixels; ++pixelIndex)
+		{
+			if (patterns.Get(pixelIndex) == patterns.None())
+				++context.m_rowUndecidedPixels[pixelIndex / context.m_outputImageWidth];
+		}
+		for (size_t y = 0; y < context.m_outputImageHeight; ++y)
+		{
+			if (context.m_rowUndecidedPixels[y] == 0)
+				StreamRow(context, y);
+		}
+	}
+
+	// nothing to undo yet
+	context.m_undoLog.Init(context.m_numPixels);
+	context.m_initializeSeconds += SecondsSince(initializeStart);
+
+	if (restored)
+	{
+		if (!context.m_initialState->m_pinned)
+			return EObserveResult::e_failure;
+	}
+	else
+	{
+		if (!ApplyPins(context))
+			return EObserveResult::e_failure;
+
+		// propagate anything that was impossible from the start
+		PropagateAllChanges(context);
+	}
+
+	// Do wave collapse
+	EObserveResult observeResult = EObserveResult::e_notDone;
+    uint32 lastPercent = 0;
+	if (reportProgress)
+		NTRACE("Progress: 0%%");
+	while (1)
+	{
+		if (cancel && cancel->load(std::memory_order_relaxed))
+			return EObserveResult::e_notDone;
+
+		size_t undecidedPixels = 0;
+		TClock::time_point observeStart = TClock::now();
+		observeResult = Observe(context, undecidedPixels);
+		context.m_observeSeconds += SecondsSince(observeStart);
+		if (observeResult == EObserveResult::e_failure && Backtrack(context))
+		{
+			PropagateAllChanges(context);
+			continue;
+		}
+		if (observeResult != EObserveResult::e_notDone)
+			break;
+
+        uint32 percent = 100 - uint32(100.0f * float(undecidedPixels) / float(context.m_numPixels));
+        
+        if (reportProgress && lastPercent != percent)
+        {
+            NTRACE("\rProgress: %i%%", percent);
+            lastPercent = percent;
+        }
+
+		PropagateAllChanges(context);
+	}
+	return observeResult;
+}
+
+// Copies everything but the seed and the solve state from settings to solver
+void CopySolverSettings (SContext& solver, const SContext& settings)
+{
+	solver.m_propagationEngine = settings.m_propagationEngine;
+	solver.m_entropyHeuristic = settings.m_entropyHeuristic;
+	solver.m_undoLog.m_maxDepth = settings.m_undoLog.m_maxDepth;
+	solver.m_undoLog.m_maxBytes = settings.m_undoLog.m_maxBytes;
+	solver.m_undoLog.m_maxBacktracks = settings.m_undoLog.m_maxBacktracks;
+	solver.m_undoLog.m_backjump = settings.m_undoLog.m_backjump;
+	solver.m_periodicOutput = settings.m_periodicOutput;
+	solver.m_numThreads = settings.m_numThreads;
+	solver.m_outputImageWidth = settings.m_outputImageWidth;
+	solver.m_outputImageHeight = settings.m_outputImageHeight;
+	solver.m_numPixels = settings.m_numPixels;
+}
+
+// Solves with numSolvers seeds at once, each on it's own thread: settings' seed, then seed + 1, seed + 2 and so on.  Everything else
+// is copied from settings, including it's pins and initial state, and they all share settings' model.  The first solve to succeed cancels the rest, and is returned in
+// winnerIndex.  If they all fail, returns e_failure with winnerIndex 0.
+EObserveResult RunPortfolio (const SContext& settings, size_t numSolvers, std::vector<std::unique_ptr<SContext>>& solvers, size_t& winnerIndex)
+{
+	solvers.clear();
+	for (size_t solverIndex = 0; solverIndex < numSolvers; ++solverIndex)
+	{
+		solvers.emplace_back(new SContext(settings.m_model, settings.m_prng.Seed() + (uint32)solverIndex));
+		SContext& solver = *solvers.back();
+		CopySolverSettings(solver, settings);
+		solver.m_numThreads = std::max<size_t>(1, settings.m_numThreads / numSolvers);
+		solver.m_pinnedPixels = settings.m_pinnedPixels;
+		solver.m_pinnedColors = settings.m_pinnedColors;
+		solver.m_initialState = settings.m_initialState;
+	}
+
+	std::atomic<bool> cancel(false);
+	std::atomic<size_t> winner(numSolvers);
+	std::vector<EObserveResult> results(numSolvers);
+	std::vector<double> seconds(numSolvers);
+	ParallelFor(numSolvers, numSolvers,
+		[&] (size_t beginSolver, size_t endSolver, size_t)
+		{
+			for (size_t solverIndex = beginSolver; solverIndex < endSolver; ++solverIndex)
+			{
+				TClock::time_point start = TClock::now();
+				results[solverIndex] = Run(*solvers[solverIndex], &cancel, false);
+				seconds[solverIndex] = SecondsSince(start);
+
+				size_t noWinner = numSolvers;
+				if (results[solverIndex] == EObserveResult::e_success && winner.compare_exchange_strong(noWinner, solverIndex))
+					cancel.store(true, std::memory_order_relaxed);
+			}
+		}
+	);
+
+	winnerIndex = winner.load();
+	for (size_t solverIndex = 0; solverIndex < numSolvers; ++solverIndex)
+	{
+		const char* result = "cancelled";
+		if (solverIndex == winnerIndex)
+			result = "won";
+		else if (results[solverIndex] == EObserveResult::e_success)
+			result = "succeeded";
+		else if (results[solverIndex] == EObserveResult::e_failure)
+			result = "failed";
+		printf("  seed %u: %s in %0.3f ms\n", solvers[solverIndex]->m_prng.Seed(), result, seconds[solverIndex] * 1000.0);
+	}
+
+	if (winnerIndex == numSolvers)
+	{
+		printf("Portfolio: all %zu seeds failed\n", numSolvers);
+		winnerIndex = 0;
+		return EObserveResult::e_failure;
+	}
+	printf("Portfolio: seed %u won\n", solvers[winnerIndex]->m_prng.Seed());
+	return EObserveResult::e_success;
+}
+
+// Solves numSeeds times in the same context, with context's seed, then seed + 1, seed + 2 and so on, saving each success as
+// <sample>.out.<seed>.bmp.  The pins are propagated once, into an initial state that every seed starts from.  Returns how many of the
+// seeds succeeded and were saved, and sets numUnsaved to how many succeeded but couldn't be saved.
+size_t RunSeeds (SContext& context, size_t numSeeds, size_t& numUnsaved)
+{
+	numUnsaved = 0;
+	SInitialState initialState;
+	TClock::time_point start = TClock::now();
+	const bool pinsAgree = SaveInitialState(context, initialState);
+	const double initialStateSeconds = SecondsSince(start);
+	if (!pinsAgree)
+	{
+		NTRACE("The pins contradict each other, so every seed would fail\n");
+		return 0;
+	}
+
+	context.m_initialState = &initialState;
+	const uint32 firstSeed = context.m_prng.Seed();
+	size_t successes = 0;
+	double initializeSeconds = 0.0;
+	double solveSeconds = 0.0;
+	for (size_t seedIndex = 0; seedIndex < numSeeds; ++seedIndex)
+	{
+		const uint32 seed = firstSeed + (uint32)seedIndex;
+		context.m_prng = SPRNG(seed);
+		context.m_initializeSeconds = 0.0;
+		start = TClock::now();
+		const bool success = Run(context, nullptr, false) == EObserveResult::e_success;
+		solveSeconds += SecondsSince(start);
+		initializeSeconds += context.m_initializeSeconds;
+		if (!success)
+			continue;
+
+		char fileName[256];
+		sprintf(fileName, "%s.out.%u.bmp", context.m_model.m_fileName.c_str(), seed);
+		if (SaveObservedImage(context, fileName))
+			++successes;
+		else
+			++numUnsaved;
+	}
+	context.m_initialState = nullptr;
+
+	NTRACE("%zu of %zu seeds succeeded and were saved.  Propagated the pins once in %0.3f ms, then each seed copied that in %0.3f ms and solved in %0.3f ms on average\n",
+		successes, numSeeds, initialStateSeconds * 1000.0, initializeSeconds * 1000.0 / double(numSeeds), solveSeconds * 1000.0 / double(numSeeds));
+	return successes;
+}
+
+// Makes a solver for a width x height region of a bigger output.  The region is never periodic, since it's edges aren't the output's
+// edges.  Add pinned pixels for the decided pixels around it, then Run() it.
+std::unique_ptr<SContext> MakeRegionSolver (const SContext& settings, uint32 seed, size_t width, size_t height)
+{
+	std::unique_ptr<SContext> solver(new SContext(settings.m_model, seed));
+	CopySolverSettings(*solver, settings);
+	solver->m_periodicOutput = false;
+	solver->m_outputImageWidth = width;
+	solver->m_outputImageHeight = height;
+	solver->m_numPixels = width * height;
+	return solver;
+}
+
+// Pins each pixel in the region that isPinned(x, y) says to, to what decided has there.  (decidedX, decidedY) is where the region's top
+// left pixel is in decided.
+template <typename LAMBDA>
+void PinDecidedPixels (SContext& region, const SObservedPixels& decided, size_t decidedWidth, size_t decidedX, size_t decidedY, LAMBDA&& isPinned)
+{
+	const size_t positionCount = region.m_positionsPerAxis * region.m_positionsPerAxis;
+	for (size_t y = 0; y < region.m_outputImageHeight; ++y)
+	{
+		for (size_t x = 0; x < region.m_outputImageWidth; ++x)
+		{
+			if (isPinned(x, y))
+				region.m_pinnedPixels.push_back({ y * region.m_outputImageWidth + x, decided.Possibility((decidedY + y) * decidedWidth + decidedX + x, positionCount) });
+		}
+	}
+}
+
+// Copies the width x height pixels at (regionX, regionY) in the solved region to (destX, destY) in dest
+void CopyDecidedPixels (const SContext& region, size_t regionX, size_t regionY, size_t width, size_t height, SObservedPixels& dest, size_t destWidth, size_t destX, size_t destY)
+{
+	for (size_t y = 0; y < height; ++y)
+	{
+		for (size_t x = 0; x < width; ++x)
+			dest.Copy((destY + y) * destWidth + destX + x, region.m_observedPixels, (regionY + y) * region.m_outputImageWidth + regionX + x);
+	}
+}
+
+// Generates settings' output size in chunkSize x chunkSize chunks in scanline order, and writes the image a band of chunks at a time, so
+// only one chunk's wave and one band of decided pixels are ever in memory.  Each chunk is solved with the decided pixels within reach of
+// it pinned: the N-1 rows above it and columns left of it, which is as far as the propagator's 2N-1 wide window reaches.  The region
+// also takes in 2(N-1) undecided pixels right of and below the chunk, so the chunk can't decide on something the next chunks can't
+// follow.  That's the N-1 pixels the next chunks have to agree with it on, plus the pinned pixels those reach.  They get thrown away and
+// solved again with their own chunks.  A chunk that fails is retried with other seeds.
+EObserveResult RunChunked (const SContext& settings, size_t chunkSize)
+{
+	static const size_t c_maxChunkAttempts = 16;
+	const size_t outputWidth = settings.m_outputImageWidth;
+	const size_t outputHeight = settings.m_outputImageHeight;
+	const size_t margin = settings.m_tileSize - 1;
+	const size_t lookahead = margin * 2;
+	const size_t positionCount = settings.m_positionsPerAxis * settings.m_positionsPerAxis;
+	chunkSize = std::max(chunkSize, settings.m_tileSize);
+	if (settings.m_periodicOutput)
+		printf("Chunked output can't be periodic, ignoring periodic output\n");
+
+	char fileName[256];
+	strcpy(fileName, settings.m_model.m_fileName.c_str());
+	strcat(fileName, ".out.bmp");
+	SImageFileWriter writer;
+	if (!writer.Open(fileName, outputWidth, outputHeight))
+	{
+		fprintf(stderr, "Could not write image: %s\n", fileName);
+		return EObserveResult::e_failure;
+	}
+
+	// the decided pixels for the band of chunks being solved, and the margin rows above it from the last band.  Row 0 is output row
+	// bandY - margin.
+	SObservedPixels band;
+	band.Init(outputWidth * (margin + chunkSize), settings.m_palletizedImage.m_pallete.size(), settings.m_patterns.Size(), positionCount);
+	std::vector<SPixel> row(outputWidth);
+
+	SPRNG prng(settings.m_prng.Seed());
+	size_t numChunks = 0;
+	size_t retries = 0;
+	size_t maxWaveBytes = 0;
+	TClock::time_point start = TClock::now();
+	for (size_t bandY = 0; bandY < outputHeight; bandY += chunkSize)
+	{
+		const size_t bandEndY = std::min(outputHeight, bandY + chunkSize);
+		for (size_t chunkX = 0; chunkX < outputWidth; chunkX += chunkSize)
+		{
+			const size_t chunkEndX = std::min(outputWidth, chunkX + chunkSize);
+			const size_t regionX = chunkX > margin ? chunkX - margin : 0;
+			const size_t regionY = bandY > margin ? bandY - margin : 0;
+			const size_t regionEndX = std::min(outputWidth, chunkEndX + lookahead);
+			const size_t regionEndY = std::min(outputHeight, bandEndY + lookahead);
+
+			EObserveResult result = EObserveResult::e_failure;
+			for (size_t attempt = 0; attempt < c_maxChunkAttempts && result != EObserveResult::e_success; ++attempt)
+			{
+				if (attempt > 0)
+					++retries;
+				std::unique_ptr<SContext> chunk = MakeRegionSolver(settings, prng.RandomInt<uint32>(0, 0xFFFFFFFE), regionEndX - regionX, regionEndY - regionY);
+
+				// pin everything in the region that an earlier chunk decided: the rows above this band, and the columns left of this chunk
+				PinDecidedPixels(*chunk, band, outputWidth, regionX, regionY + margin - bandY,
+					[&] (size_t x, size_t y)
+					{
+						return regionY + y < bandY || (regionY + y < bandEndY && regionX + x < chunkX);
+					}
+				);
+
+				result = Run(*chunk, nullptr, false);
+				maxWaveBytes = std::max(maxWaveBytes, chunk->m_wave.m_words.size() * sizeof(uint64));
+				if (result != EObserveResult::e_success)
+					continue;
+
+				CopyDecidedPixels(*chunk, chunkX - regionX, bandY - regionY, chunkEndX - chunkX, bandEndY - bandY, band, outputWidth, chunkX, margin);
+			}
+			++numChunks;
+
+			if (result != EObserveResult::e_success)
+			{
+				printf("Chunked: chunk at %zu,%zu failed %zu times, giving up\n", chunkX, bandY, c_maxChunkAttempts);
+				return EObserveResult::e_failure;
+			}
+		}
+
+		// the band is done, so write it out, and keep it's last rows to pin the top of the next band
+		for (size_t y = bandY; y < bandEndY; ++y)
+		{
+			for (size_t x = 0; x < outputWidth; ++x)
+				row[x] = settings.m_palletizedImage.m_pallete[band.m_colors.Get((y + margin - bandY) * outputWidth + x)];
+			writer.WriteRow(y, &row[0]);
+		}
+		for (size_t marginRow = 0; marginRow < margin; ++marginRow)
+		{
+			for (size_t x = 0; x < outputWidth; ++x)
+				band.Copy(marginRow * outputWidth + x, band, (chunkSize + marginRow) * outputWidth + x);
+		}
+	}
+
+	if (!writer.Close())
+	{
+		fprintf(stderr, "Could not write image: %s\n", fileName);
+		return EObserveResult::e_failure;
+	}
+
+	printf("Chunked: %zu x %zu output in %zu chunks of %zu x %zu, %zu retries, %zu KB of wave per chunk, %zu KB of decided pixels, %0.3f ms\n",
+		outputWidth, outputHeight, numChunks, chunkSize, chunkSize, retries, maxWaveBytes / 1024,
+		(band.m_colors.Bytes() + band.m_patterns.Bytes() + band.m_positions.Bytes()) / 1024, SecondsSince(start) * 1000.0);
+	return EObserveResult::e_success;
+}
+
+// Solves settings' output size by modifying it in blocks.  It starts out as a periodic blockSize x blockSize solve tiled across the
+// output, which is valid everywhere since the tile is periodic.  Then until the time runs out, a random blockSize x blockSize block is
+// reset and solved again, with the N-1 pixels around it pinned, so it has to fit back in.  A block that fails just keeps what it had, so
+// the output is always valid and only one block's wave is ever in memory.  The result goes in context.m_observedPixels.
+EObserveResult RunModifyInBlocks (SContext& context, size_t blockSize, double seconds)
+{
+	static const size_t c_maxTileAttempts = 16;
+	const size_t outputWidth = context.m_outputImageWidth;
+	const size_t outputHeight = context.m_outputImageHeight;
+	const size_t margin = context.m_tileSize - 1;
+	blockSize = std::max(blockSize, context.m_tileSize);
+	if (context.m_periodicOutput)
+		printf("Modifying in blocks can't make periodic output, ignoring periodic output\n");
+
+	// solve the tile
+	TClock::time_point start = TClock::now();
+	std::unique_ptr<SContext> tile;
+	for (size_t attempt = 0; attempt < c_maxTileAttempts; ++attempt)
+	{
+		tile = MakeRegionSolver(context, context.m_prng.RandomInt<uint32>(0, 0xFFFFFFFE), blockSize, blockSize);
+		tile->m_periodicOutput = true;
+		if (Run(*tile, nullptr, false) == EObserveResult::e_success)
+			break;
+		tile.reset();
+	}
+	if (!tile)
+	{
+		printf("Modify in blocks: the %zu x %zu tile failed %zu times, giving up\n", blockSize, blockSize, c_maxTileAttempts);
+		return EObserveResult::e_failure;
+	}
+
+	// tile it across the output
+	SObservedPixels& output = context.m_observedPixels;
+	output.Init(context.m_numPixels, context.m_palletizedImage.m_pallete.size(), context.m_patterns.Size(), context.m_positionsPerAxis * context.m_positionsPerAxis);
+	for (size_t y = 0; y < outputHeight; ++y)
+	{
+		for (size_t x = 0; x < outputWidth; ++x)
+			output.Copy(y * outputWidth + x, tile->m_observedPixels, (y % blockSize) * blockSize + x % blockSize);
+	}
+	tile.reset();
+
+	// re-solve random blocks until the time is up
+	size_t numBlocks = 0;
+	size_t failedBlocks = 0;
+	size_t maxWaveBytes = 0;
+	while (SecondsSince(start) < seconds)
+	{
+		const size_t blockX = context.m_prng.RandomInt<size_t>(0, outputWidth - 1);
+		const size_t blockY = context.m_prng.RandomInt<size_t>(0, outputHeight - 1);
+		const size_t blockEndX = std::min(outputWidth, blockX + blockSize);
+		const size_t blockEndY = std::min(outputHeight, blockY + blockSize);
+		const size_t regionX = blockX > margin ? blockX - margin : 0;
+		const size_t regionY = blockY > margin ? blockY - margin : 0;
+		const size_t regionEndX = std::min(outputWidth, blockEndX + margin);
+		const size_t regionEndY = std::min(outputHeight, blockEndY + margin);
+
+		std::unique_ptr<SContext> block = MakeRegionSolver(context, context.m_prng.RandomInt<uint32>(0, 0xFFFFFFFE), regionEndX - regionX, regionEndY - regionY);
+		PinDecidedPixels(*block, output, outputWidth, regionX, regionY,
+			[&] (size_t x, size_t y)
+			{
+				return regionX + x < blockX || regionX + x >= blockEndX || regionY + y < blockY || regionY + y >= blockEndY;
+			}
+		);
+
+		++numBlocks;
+		if (Run(*block, nullptr, false) == EObserveResult::e_success)
+			CopyDecidedPixels(*block, blockX - regionX, blockY - regionY, blockEndX - blockX, blockEndY - blockY, output, outputWidth, blockX, blockY);
+		else
+			++failedBlocks;
+		maxWaveBytes = std::max(maxWaveBytes, block->m_wave.m_words.size() * sizeof(uint64));
+	}
+
+	printf("Modify in blocks: %zu x %zu output, %zu blocks of %zu x %zu re-solved, %zu failed and were kept, %zu KB of wave per block, %0.3f ms\n",
+		outputWidth, outputHeight, numBlocks, blockSize, blockSize, failedBlocks, maxWaveBytes / 1024, SecondsSince(start) * 1000.0);
+	return EObserveResult::e_success;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                    MODEL CACHE
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// A built model can be saved to a cache file next to its sample image, and mapped back in on later runs instead of being rebuilt.
+// The file is a header followed by sections at 64 byte aligned offsets, each laid out exactly like the model uses it, so the propagator
+// is used straight from the mapping without being parsed or copied.  The header records the build parameters and a hash of the
+// sample file, and a cache file that doesn't match is rebuilt and overwritten.
+
+static const uint32 c_modelCacheMagic = 0x4D434657;	// "WFCM"
+static const uint32 c_modelCacheVersion = 2;	// 2: symmetry adds the reflected patterns
+
+enum class EModelCacheSection
+{
+	e_pallete,				// SPixel[numColors]
+	e_patternPixels,		// [numPatterns][tileSize*tileSize], pixelWidth bytes each
+	e_patternCounts,		// uint64[numPatterns]
+	e_patternHashes,		// uint64[numPatterns]
+	e_propagatorOffsets,	// uint64[numLists + 1]
+	e_propagatorPatterns,	// uint32[numEntries]
+
+	e_count
+};
+
+struct SModelCacheSection
+{
+	uint64	m_offset;	// from the start of the file
+	uint64	m_size;		// in bytes
+};
+
+struct SModelCacheHeader
+{
+	uint32	m_magic;
+	uint32	m_version;
+	uint64	m_imageHash;
+
+	// build parameters
+	uint64	m_tileSize;
+	uint64	m_symmetry;
+	uint64	m_periodicInput;
+	uint64	m_domain;
+
+	// sizes
+	uint64	m_imageWidth;
+	uint64	m_imageHeight;
+	uint64	m_numColors;
+	uint64	m_numPatterns;
+	uint64	m_pixelWidth;
+	uint64	m_numLists;
+	uint64	m_numEntries;
+
+	SModelCacheSection	m_sections[(size_t)EModelCacheSection::e_count];
+};
+
+// FNV-1a of the file's bytes.  Returns false if the file can't be read.
+bool HashFile (const char* fileName, uint64& hash)
+{
+	FILE* file = fopen(fileName, "rb");
+	if (!file)
+		return false;
+
+	hash = 0xCBF29CE484222325ull;
+	uint8 buffer[65536];
+	size_t bytesRead;
+	while ((bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+	{
+		for (size_t index = 0; index < bytesRead; ++index)
+			hash = (hash ^ buffer[index]) * 0x100000001B3ull;
+	}
+	fclose(file);
+	return true;
+}
+
+std::string ModelCacheFileName (const SModel& model)
+{
+	char suffix[64];
+	sprintf(suffix, ".N%zu.S%u.%s.%s.model", model.m_tileSize, (uint32)model.m_symmetry, model.m_periodicInput ? "periodic" : "clamped",
+		model.m_domain == EDomain::e_patternAnchored ? "anchored" : "positions");
+	return model.m_fileName + suffix;
+}
+
+// Writes to a temporary file that is renamed over the cache file once complete, so a reader never maps a half written one
+bool SaveModelCache (const SModel& model, uint64 imageHash)
+{
+	PROFILE_SCOPE("SaveModelCache");
+	SModelCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.m_magic = c_modelCacheMagic;
+	header.m_version = c_modelCacheVersion;
+	header.m_imageHash = imageHash;
+	header.m_tileSize = model.m_tileSize;
+	header.m_symmetry = model.m_symmetry;
+	header.m_periodicInput = model.m_periodicInput ? 1 : 0;
+	header.m_domain = (uint64)model.m_domain;
+	header.m_imageWidth = model.m_palletizedImage.m_width;
+	header.m_imageHeight = model.m_palletizedImage.m_height;
+	header.m_numColors = model.m_palletizedImage.m_pallete.size();
+	header.m_numPatterns = model.m_patterns.Size();
+	header.m_pixelWidth = model.m_patterns.m_pixels.Width();
+	header.m_numLists = model.m_propagator.NumLists();
+	header.m_numEntries = model.m_propagator.NumEntries();
+
+	const void* sectionData[(size_t)EModelCacheSection::e_count] =
+	{
+		model.m_palletizedImage.m_pallete.data(),
+		model.m_patterns.m_pixels.Data<uint8>(),
+		model.m_patterns.m_counts.data(),
+		model.m_patterns.m_hashes.data(),
+		model.m_propagator.m_offsets,
+		model.m_propagator.m_patterns,
+	};
+	const size_t sectionSizes[(size_t)EModelCacheSection::e_count] =
+	{
+		model.m_palletizedImage.m_pallete.size() * sizeof(SPixel),
+		model.m_patterns.m_pixels.Bytes(),
+		model.m_patterns.m_counts.size() * sizeof(uint64),
+		model.m_patterns.m_hashes.size() * sizeof(uint64),
+		(header.m_numLists + 1) * sizeof(uint64),
+		header.m_numEntries * sizeof(uint32),
+	};
+	uint64 offset = sizeof(header);
+	for (size_t sectionIndex = 0; sectionIndex < (size_t)EModelCacheSection::e_count; ++sectionIndex)
+	{
+		offset = (offset + c_cacheLineBytes - 1) & ~(uint64)(c_cacheLineBytes - 1);
+		header.m_sections[sectionIndex].m_offset = offset;
+		header.m_sections[sectionIndex].m_size = sectionSizes[sectionIndex];
+		offset += sectionSizes[sectionIndex];
+	}
+
+	const std::string fileName = ModelCacheFileName(model);
+	const std::string tempFileName = fileName + ".tmp";
+	FILE* file = fopen(tempFileName.c_str(), "wb");
+	if (!file)
+		return false;
+	bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+	const uint8 padding[c_cacheLineBytes] = { 0 };
+	for (size_t sectionIndex = 0; success && sectionIndex < (size_t)EModelCacheSection::e_count; ++sectionIndex)
+	{
+		const SModelCacheSection& section = header.m_sections[sectionIndex];
+		size_t paddingSize = (size_t)(section.m_offset - ftell(file));
+		success = fwrite(padding, 1, paddingSize, file) == paddingSize;
+		if (success && section.m_size > 0)
+			success = fwrite(sectionData[sectionIndex], (size_t)section.m_size, 1, file) == 1;
+	}
+	success = fclose(file) == 0 && success;
+
+	// rename() won't replace an existing file on windows
+	if (success && rename(tempFileName.c_str(), fileName.c_str()) != 0)
+	{
+		remove(fileName.c_str());
+		success = rename(tempFileName.c_str(), fileName.c_str()) == 0;
+	}
+	if (!success)
+		remove(tempFileName.c_str());
+	return success;
 }
 
-void GetPatterns (SContext& context)
+// Fills in the model from its cache file, if there is one that matches the model's build parameters and sample.  The palette and pattern
+// table are copied out, and the propagator keeps the file mapped.  A truncated or corrupt file, with any offset, pattern index or color out
+// of range, returns false like a stale one, so the model is rebuilt and the file rewritten.
+bool LoadModelCache (SModel& model, uint64 imageHash)
 {
-	TPattern srcPattern;
-	TPattern tmpPattern;
-	srcPattern.resize(context.m_tileSize*context.m_tileSize);
-	tmpPattern.resize(context.m_tileSize*context.m_tileSize);
+	PROFILE_SCOPE("LoadModelCache");
+	std::unique_ptr<SMappedFile> file(new SMappedFile());
+	if (!file->Open(ModelCacheFileName(model).c_str()) || file->m_size < sizeof(SModelCacheHeader))
+		return false;
+
+	const SModelCacheHeader& header = *(const SModelCacheHeader*)file->m_data;
+	if (header.m_magic != c_modelCacheMagic || header.m_version != c_modelCacheVersion || header.m_imageHash != imageHash ||
+		header.m_tileSize != model.m_tileSize || header.m_symmetry != model.m_symmetry || header.m_periodicInput != (model.m_periodicInput ? 1u : 0u) ||
+		header.m_domain != (uint64)model.m_domain)
+		return false;
+
+	// make sure every section is where it can be used, and is the size the header says it should be.  Every count is bounded by the
+	// file size first, so a corrupt header can't overflow the expected sizes into a match.
+	if (header.m_numColors > file->m_size || header.m_numPatterns > file->m_size || header.m_numLists > file->m_size ||
+		header.m_numEntries > file->m_size || header.m_pixelWidth > sizeof(uint32))
+		return false;
+	const size_t dims = model.m_tileSize * 2 - 1;
+	const size_t patternSize = model.m_tileSize * model.m_tileSize;
+	const uint64 expectedSizes[(size_t)EModelCacheSection::e_count] =
+	{
+		header.m_numColors * sizeof(SPixel),
+		header.m_numPatterns * patternSize * header.m_pixelWidth,
+		header.m_numPatterns * sizeof(uint64),
+		header.m_numPatterns * sizeof(uint64),
+		(header.m_numLists + 1) * sizeof(uint64),
+		header.m_numEntries * sizeof(uint32),
+	};
+	if (header.m_numLists != dims * dims * header.m_numPatterns)
+		return false;
+	for (size_t sectionIndex = 0; sectionIndex < (size_t)EModelCacheSection::e_count; ++sectionIndex)
+	{
+		const SModelCacheSection& section = header.m_sections[sectionIndex];
+		if (section.m_size != expectedSizes[sectionIndex] || section.m_offset % sizeof(uint64) != 0 || section.m_offset > file->m_size ||
+			section.m_size > file->m_size - section.m_offset)
+			return false;
+	}
+	auto sectionData = [&] (EModelCacheSection section) { return file->m_data + header.m_sections[(size_t)section].m_offset; };
 
-	size_t maxX = context.m_palletizedImage.m_width - (context.m_periodicInput ? context.m_tileSize : 0);
-	size_t maxY = context.m_palletizedImage.m_height - (context.m_periodicInput ? context.m_tileSize : 0);
-	for (size_t y = 0; y < maxY; ++y)
+	const uint64* offsets = (const uint64*)sectionData(EModelCacheSection::e_propagatorOffsets);
+	for (size_t listIndex = 0; listIndex < header.m_numLists; ++listIndex)
 	{
-		for (size_t x = 0; x < maxX; ++x)
+		if (offsets[listIndex] > offsets[listIndex + 1])
+			return false;
+	}
+	if (offsets[0] != 0 || offsets[header.m_numLists] != header.m_numEntries)
+		return false;
+
+	// propagation indexes the wave with every propagator entry
+	const uint32* patterns = (const uint32*)sectionData(EModelCacheSection::e_propagatorPatterns);
+	for (size_t entryIndex = 0; entryIndex < header.m_numEntries; ++entryIndex)
+	{
+		if (patterns[entryIndex] >= header.m_numPatterns)
+			return false;
+	}
+
+	// the pallete
+	const SPixel* pallete = (const SPixel*)sectionData(EModelCacheSection::e_pallete);
+	model.m_palletizedImage.m_pallete.assign(pallete, pallete + header.m_numColors);
+	model.m_palletizedImage.m_width = (size_t)header.m_imageWidth;
+	model.m_palletizedImage.m_height = (size_t)header.m_imageHeight;
+	model.m_palletizedImage.m_bpp = 1;
+	for (size_t maxValue = 2; maxValue < header.m_numColors; maxValue *= 2)
+		++model.m_palletizedImage.m_bpp;
+
+	// the patterns, added in the same order so their indices match the propagator
+	model.m_patterns.Init(model.m_tileSize, (size_t)header.m_numColors);
+	if (model.m_patterns.m_pixels.Width() != header.m_pixelWidth)
+		return false;
+	const uint64* counts = (const uint64*)sectionData(EModelCacheSection::e_patternCounts);
+	const uint64* hashes = (const uint64*)sectionData(EModelCacheSection::e_patternHashes);
+	bool pixelsInPallete = true;
+	model.m_patterns.m_pixels.Dispatch(
+		[&] (auto* typedPixels)
+		{
+			typedef typename std::remove_pointer<decltype(typedPixels)>::type T;
+			const T* patternPixels = (const T*)sectionData(EModelCacheSection::e_patternPixels);
+			for (size_t pixelIndex = 0; pixelIndex < header.m_numPatterns * patternSize; ++pixelIndex)
+				pixelsInPallete = pixelsInPallete && patternPixels[pixelIndex] < header.m_numColors;
+			for (size_t patternIndex = 0; pixelsInPallete && patternIndex < header.m_numPatterns; ++patternIndex)
+				model.m_patterns.Add(patternPixels + patternIndex * patternSize, hashes[patternIndex], counts[patternIndex]);
+		}
+	);
+	if (!pixelsInPallete || model.m_patterns.Size() != header.m_numPatterns)
+		return false;
+
+	// the propagator stays in the file
+	const size_t numLists = (size_t)header.m_numLists;
+	model.m_propagator.Map(std::move(file), numLists, offsets, patterns);
+	return true;
+}
+
+// Loads the model's image and builds everything a solve needs from it.  The model's type, file name, tile size, symmetry, input
+// periodicity and domain need to be set first.  If the model uses a cache file, a matching one is loaded instead, and a missing or stale one is
+// written once the model is built.  Returns false if the image couldn't be loaded, or is smaller than a pattern.
+bool BuildModel (SModel& model, bool reportScaling)
+{
+	// the simple tiled model is quick to build from it's tileset and rules, so it isn't cached
+	model.m_loadedFromCache = false;
+	model.m_loadSeconds = model.m_palletizeSeconds = model.m_patternsSeconds = model.m_propagatorSeconds = 0.0;
+	if (model.m_type == EModelType::e_simpleTiled)
+		return BuildTiledModel(model);
+
+	// the scaling reports need the image, so they always build
+	uint64 imageHash = 0;
+	const bool useCacheFile = model.m_useCacheFile && HashFile(model.m_fileName.c_str(), imageHash);
+	TClock::time_point start = TClock::now();
+	if (useCacheFile && !reportScaling && LoadModelCache(model, imageHash))
+	{
+		model.m_loadedFromCache = true;
+		model.m_loadSeconds = SecondsSince(start);
+	}
+	else
+	{
+		// Load image
+		if (!LoadImage(model.m_fileName.c_str(), model.m_colorImage))
+			return false;
+		model.m_loadSeconds = SecondsSince(start);
+
+		// every pattern has to fit in the image
+		if (model.m_tileSize > model.m_colorImage.m_width || model.m_tileSize > model.m_colorImage.m_height)
+			return false;
+
+		// Palletize the image for simpler processing of pixels
+		if (reportScaling)
+			ReportPalletizeImageScaling(model);
+		start = TClock::now();
+		PalletizeImage(model.m_colorImage, model.m_palletizedImage, model.m_numThreads);
+		model.m_palletizeSeconds = SecondsSince(start);
+
+		// Gather the patterns from the source data
+		if (reportScaling)
+			ReportGetPatternsScaling(model);
+		start = TClock::now();
+		GetPatterns(model);
+		model.m_patternsSeconds = SecondsSince(start);
+
+		// generate the propagator, which tells us which patterns agree with each other at each offset
+		start = TClock::now();
+		BuildPropagator(model);
+		model.m_propagatorSeconds = SecondsSince(start);
+
+		if (useCacheFile && !SaveModelCache(model, imageHash))
+			fprintf(stderr, "Could not write model cache file %s\n", ModelCacheFileName(model).c_str());
+	}
+
+	model.m_positionsPerAxis = model.m_domain == EDomain::e_patternAnchored ? 1 : model.m_tileSize;
+	model.m_boolsPerPixel = model.m_patterns.Size() * model.m_positionsPerAxis * model.m_positionsPerAxis;
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                      SERVER
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The server reads one JSON request per line, like this (every field is optional):
+//
+//   {"id": 7, "sample": "Samples/Knot.bmp", "N": 3, "symmetry": 8, "periodicInput": true, "anchored": false,
+//    "width": 48, "height": 48, "seed": 1, "periodicOutput": true, "heuristic": "shannon", "output": "Knot.7.bmp"}
+//
+// and answers each one with a line like this, in whatever order the solves finish:
+//
+//   {"id": 7, "status": "success", "output": "Knot.7.bmp", "cached": true, "queueMs": 0.01, "modelMs": 0.00, "solveMs": 9.31, "totalMs": 9.33}
+//
+// heuristic picks which cell is observed next: "minCount", the default, or "shannon", see EEntropyHeuristic.
+//
+// {"command": "stats"} answers with how many requests have been handled, their latencies, and how the model cache is doing.
+//
+// sample and output are read and written relative to the server's working directory, and can't leave it: absolute paths and ".." are
+// errors.  Anything that can connect to the server can still read every sample and overwrite every file under that directory, see -socket.
+//
+// N can be from 2 up to the sample's width and height, and at most c_maxServerTileSize.  Width and height are at most
+// c_maxServerOutputSize.  Anything out of range, and any model that can't be built, gets an "error" status instead of a solve.
+
+// Just enough JSON for server requests: one flat object, with string, number, true, false and null values
+struct SJsonObject
+{
+	struct SField
+	{
+		std::string	m_key;
+		std::string	m_value;	// unescaped if it was a string, otherwise the text as is
+		bool		m_isString;
+	};
+
+	bool Parse (const std::string& text, std::string& error)
+	{
+		m_fields.clear();
+		const char* c = text.c_str();
+		SkipSpace(c);
+		if (*c++ != '{')
+		{
+			error = "expected an object";
+			return false;
+		}
+		SkipSpace(c);
+		if (*c == '}')
+			return true;
+
+		while (1)
+		{
+			SField field;
+			SkipSpace(c);
+			if (!ParseString(c, field.m_key))
+			{
+				error = "expected a key";
+				return false;
+			}
+			SkipSpace(c);
+			if (*c++ != ':')
+			{
+				error = "expected ':' after \"" + field.m_key + "\"";
+				return false;
+			}
+			SkipSpace(c);
+			field.m_isString = *c == '"';
+			if (field.m_isString)
+			{
+				if (!ParseString(c, field.m_value))
+				{
+					error = "bad string for \"" + field.m_key + "\"";
+					return false;
+				}
+			}
+			else
+			{
+				const char* start = c;
+				while (*c && *c != ',' && *c != '}' && !isspace((unsigned char)*c))
+					++c;
+				field.m_value.assign(start, c);
+				if (field.m_value.empty())
+				{
+					error = "missing value for \"" + field.m_key + "\"";
+					return false;
+				}
+			}
+			m_fields.push_back(field);
+
+			SkipSpace(c);
+			if (*c == '}')
+				return true;
+			if (*c++ != ',')
+			{
+				error = "expected ',' or '}'";
+				return false;
+			}
+		}
+	}
+
+	const SField* Find (const char* key) const
+	{
+		for (const SField& field : m_fields)
+		{
+			if (field.m_key == key)
+				return &field;
+		}
+		return nullptr;
+	}
+
+	std::string GetString (const char* key, const char* defaultValue) const
+	{
+		const SField* field = Find(key);
+		return field ? field->m_value : defaultValue;
+	}
+
+	double GetNumber (const char* key, double defaultValue) const
+	{
+		const SField* field = Find(key);
+		return field && !field->m_isString ? atof(field->m_value.c_str()) : defaultValue;
+	}
+
+	bool GetBool (const char* key, bool defaultValue) const
+	{
+		const SField* field = Find(key);
+		return field && !field->m_isString ? field->m_value == "true" : defaultValue;
+	}
+
+	std::vector<SField>	m_fields;
+
+private:
+	static void SkipSpace (const char*& c)
+	{
+		while (isspace((unsigned char)*c))
+			++c;
+	}
+
+	static bool ParseString (const char*& c, std::string& value)
+	{
+		if (*c++ != '"')
+			return false;
+		value.clear();
+		while (*c != '"')
 		{
-			// get and add the pattern
-			GetPattern(context.m_palletizedImage, x, y, context.m_tileSize, srcPattern);
-			AddPattern(context.m_patterns, srcPattern);
+			if (*c == 0)
+				return false;
+			if (*c != '\\')
+			{
+				value += *c++;
+				continue;
+			}
 
-			// add rotations and reflections, as instructed by symmetry parameter
-			for (uint8 i = 1; i < context.m_symmetry; ++i)
+			++c;
+			switch (*c++)
 			{
-				if (i % 2 == 1)
+				case '"': value += '"'; break;
+				case '\\': value += '\\'; break;
+				case '/': value += '/'; break;
+				case 'b': value += '\b'; break;
+				case 'f': value += '\f'; break;
+				case 'n': value += '\n'; break;
+				case 'r': value += '\r'; break;
+				case 't': value += '\t'; break;
+				case 'u':
 				{
-					ReflectPatternXAxis(srcPattern, tmpPattern, context.m_tileSize);
-					AddPattern(context.m_patterns, srcPattern);
+					// only ascii is supported, which is all file names need
+					char hex[5] = { 0 };
+					for (int digit = 0; digit < 4; ++digit)
+					{
+						if (!isxdigit((unsigned char)*c))
+							return false;
+						hex[digit] = *c++;
+					}
+					value += (char)strtol(hex, nullptr, 16);
+					break;
 				}
-				else
+				default: return false;
+			}
+		}
+		++c;
+		return true;
+	}
+};
+
+std::string JsonEscape (const std::string& text)
+{
+	std::string escaped;
+	for (char c : text)
+	{
+		switch (c)
+		{
+			case '"': escaped += "\\\""; break;
+			case '\\': escaped += "\\\\"; break;
+			case '\n': escaped += "\\n"; break;
+			case '\r': escaped += "\\r"; break;
+			case '\t': escaped += "\\t"; break;
+			default:
+			{
+				if ((unsigned char)c < 0x20)
 				{
-					RotatePatternCW90(srcPattern, tmpPattern, context.m_tileSize);
-					AddPattern(context.m_patterns, srcPattern);
-					srcPattern = tmpPattern;
+					char buffer[8];
+					sprintf(buffer, "\\u%04x", c);
+					escaped += buffer;
 				}
+				else
+					escaped += c;
 			}
 		}
 	}
+	return escaped;
 }
 
-void SavePatterns (SContext& context)
+// Least recently used cache of built models, keyed by everything that goes into building one.  Models are shared with the solves using
+// them, so one that gets evicted in the middle of a solve stays alive until the solve is done.
+struct SModelCache
 {
-	// TODO: make a function on SImageData to construct one by width / height only, and use that here and anywhere else needed.
-    SImageData tempImageData;
-    tempImageData.m_width = context.m_tileSize;
-    tempImageData.m_height = context.m_tileSize;
-    tempImageData.m_pitch = context.m_tileSize * 3;
-    if (tempImageData.m_pitch & 3)
-    {
-        tempImageData.m_pitch &= ~3;
-        tempImageData.m_pitch += 4;
-    }
-    tempImageData.m_pixels.resize(tempImageData.m_pitch*tempImageData.m_height);
-	uint64 patternIndex = 0;
-	for (const SPattern& pattern : context.m_patterns)
-    {
-		const EPalletIndex* srcPixel = &pattern.m_pattern[0];
-        for (size_t y = 0; y < context.m_tileSize; ++y)
-        {
-            for (size_t x = 0; x < context.m_tileSize; ++x)
-            {
-                *(SPixel*)&tempImageData.m_pixels[y * tempImageData.m_pitch + x * 3] = context.m_palletizedImage.m_pallete[(size_t)*srcPixel];
-				++srcPixel;
-            }
-        }
+	SModelCache (size_t capacity, bool useCacheFiles)
+		: m_capacity(std::max<size_t>(1, capacity))
+		, m_useCacheFiles(useCacheFiles)
+		, m_hits(0)
+		, m_misses(0)
+		, m_evictions(0)
+	{ }
 
-        char buffer[256];
-        sprintf(buffer, ".Pattern%I64i.%I64i.bmp", patternIndex, pattern.m_count);
+	// Returns the model, building it if it isn't cached.  Models are built without holding the lock, so other models can be looked up
+	// meanwhile.  A worker that asks for a model that another worker is building waits for that build instead of starting it's own.
+	// Returns null if the image can't be loaded, and passes on anything the build throws.
+	std::shared_ptr<const SModel> Get (const std::string& fileName, size_t tileSize, uint8 symmetry, bool periodicInput, EDomain domain, bool& cached)
+	{
+		char key[64];
+		sprintf(key, "|%zu|%u|%i|%i", tileSize, (uint32)symmetry, periodicInput ? 1 : 0, (int)domain);
+		std::string fullKey = fileName + key;
+
+		std::promise<std::shared_ptr<const SModel>> built;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			auto found = m_index.find(fullKey);
+			if (found != m_index.end())
+			{
+				++m_hits;
+				cached = true;
+				m_entries.splice(m_entries.begin(), m_entries, found->second);
+				return found->second->second;
+			}
+
+			// being built counts as cached, since this request doesn't build it
+			auto building = m_building.find(fullKey);
+			if (building != m_building.end())
+			{
+				++m_hits;
+				cached = true;
+				std::shared_future<std::shared_ptr<const SModel>> inFlight = building->second;
+				lock.unlock();
+				return inFlight.get();
+			}
+
+			++m_misses;
+			cached = false;
+			m_building[fullKey] = built.get_future().share();
+		}
+
+		std::shared_ptr<SModel> model(new SModel());
+		model->m_fileName = fileName;
+		model->m_tileSize = tileSize;
+		model->m_symmetry = symmetry;
+		model->m_periodicInput = periodicInput;
+		model->m_domain = domain;
+		model->m_useCacheFile = m_useCacheFiles;
+		bool success = false;
+		try
+		{
+			success = BuildModel(*model, false);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_building.erase(fullKey);
+			built.set_exception(std::current_exception());
+			throw;
+		}
+
+		// failed builds aren't cached, so the next request for the model tries again
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_building.erase(fullKey);
+		if (!success)
+		{
+			built.set_value(nullptr);
+			return nullptr;
+		}
+		m_entries.emplace_front(fullKey, model);
+		m_index[fullKey] = m_entries.begin();
+		if (m_entries.size() > m_capacity)
+		{
+			m_index.erase(m_entries.back().first);
+			m_entries.pop_back();
+			++m_evictions;
+		}
+		built.set_value(model);
+		return model;
+	}
+
+	typedef std::list<std::pair<std::string, std::shared_ptr<const SModel>>> TEntries;
+
+	size_t										m_capacity;
+	bool										m_useCacheFiles;	// whether models are loaded from and saved to cache files
+	std::mutex									m_mutex;
+	TEntries									m_entries;	// most recently used first
+	std::unordered_map<std::string, TEntries::iterator>	m_index;
+	std::unordered_map<std::string, std::shared_future<std::shared_ptr<const SModel>>>	m_building;	// models a worker is building now
+
+	// stats
+	uint64	m_hits;
+	uint64	m_misses;
+	uint64	m_evictions;
+};
+
+// Where replies go: stdout, or a socket connection.  The connection is closed once the last request from it has been answered.
+struct SServerConnection
+{
+	SServerConnection (int socket)
+		: m_socket(socket)
+	{ }
+
+	~SServerConnection ()
+	{
+		#ifndef _WIN32
+		if (m_socket >= 0)
+			close(m_socket);
+		#endif
+	}
+
+	void Reply (const std::string& line)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		#ifndef _WIN32
+		if (m_socket >= 0)
+		{
+			std::string text = line + "\n";
+			for (size_t sent = 0; sent < text.size(); )
+			{
+				ssize_t result = send(m_socket, text.c_str() + sent, text.size() - sent, 0);
+				if (result <= 0)
+					return;
+				sent += (size_t)result;
+			}
+			return;
+		}
+		#endif
+		fprintf(stdout, "%s\n", line.c_str());
+		fflush(stdout);
+	}
+
+	int			m_socket;	// -1 for stdout
+	std::mutex	m_mutex;
+};
+
+struct SServerJob
+{
+	std::string							m_line;
+	std::shared_ptr<SServerConnection>	m_connection;
+	TClock::time_point					m_received;
+};
+
+struct SServer
+{
+	SServer (size_t cacheSize, bool useCacheFiles)
+		: m_modelCache(cacheSize, useCacheFiles)
+		, m_closed(false)
+		, m_numRequests(0)
+		, m_numFailures(0)
+	{ }
+
+	void Push (SServerJob&& job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_jobsMutex);
+			m_jobs.push_back(std::move(job));
+		}
+		m_jobsReady.notify_one();
+	}
+
+	// waits for a job.  Returns false once the server is closed and there are no jobs left.
+	bool Pop (SServerJob& job)
+	{
+		std::unique_lock<std::mutex> lock(m_jobsMutex);
+		m_jobsReady.wait(lock, [this] () { return m_closed || !m_jobs.empty(); });
+		if (m_jobs.empty())
+			return false;
+		job = std::move(m_jobs.front());
+		m_jobs.pop_front();
+		return true;
+	}
+
+	void Close ()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_jobsMutex);
+			m_closed = true;
+		}
+		m_jobsReady.notify_all();
+	}
+
+	void RecordLatency (double totalSeconds, bool failed)
+	{
+		std::lock_guard<std::mutex> lock(m_statsMutex);
+		++m_numRequests;
+		if (failed)
+			++m_numFailures;
+		m_latencies.push_back(totalSeconds);
+	}
+
+	std::string Stats ()
+	{
+		std::vector<double> latencies;
+		uint64 numRequests, numFailures;
+		{
+			std::lock_guard<std::mutex> lock(m_statsMutex);
+			latencies = m_latencies;
+			numRequests = m_numRequests;
+			numFailures = m_numFailures;
+		}
+		std::sort(latencies.begin(), latencies.end());
+		double sum = 0.0;
+		for (double latency : latencies)
+			sum += latency;
+		auto percentile = [&] (double fraction) { return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, (size_t)(fraction * latencies.size()))] * 1000.0; };
+
+		uint64 hits, misses, evictions;
+		{
+			std::lock_guard<std::mutex> lock(m_modelCache.m_mutex);
+			hits = m_modelCache.m_hits;
+			misses = m_modelCache.m_misses;
+			evictions = m_modelCache.m_evictions;
+		}
+
+		char buffer[512];
+		sprintf(buffer, "\"requests\": %llu, \"failures\": %llu, \"meanMs\": %0.3f, \"p50Ms\": %0.3f, \"p95Ms\": %0.3f, \"maxMs\": %0.3f, "
+			"\"cacheHits\": %llu, \"cacheMisses\": %llu, \"cacheEvictions\": %llu",
+			(unsigned long long)numRequests, (unsigned long long)numFailures, latencies.empty() ? 0.0 : sum / latencies.size() * 1000.0,
+			percentile(0.5), percentile(0.95), latencies.empty() ? 0.0 : latencies.back() * 1000.0,
+			(unsigned long long)hits, (unsigned long long)misses, (unsigned long long)evictions);
+		return buffer;
+	}
+
+	SModelCache					m_modelCache;
+
+	std::mutex					m_jobsMutex;
+	std::condition_variable		m_jobsReady;
+	std::deque<SServerJob>		m_jobs;
+	bool						m_closed;
+
+	std::mutex					m_statsMutex;
+	uint64						m_numRequests;
+	uint64						m_numFailures;
+	std::vector<double>			m_latencies;	// seconds from reading each request to answering it
+};
+
+// The biggest tile size and output size a request can ask for.  Models and solves grow quickly with both, and one request shouldn't be
+// able to take every worker's memory or time.
+static const size_t c_maxServerTileSize = 5;
+static const size_t c_maxServerOutputSize = 256;
+
+// Whether a file name from a request stays under the server's working directory: relative, with no drive and no ".." parts.  Either
+// slash separates parts, since the samples are named with backslashes.
+bool IsServerPath (const std::string& path)
+{
+	if (path.empty() || path[0] == '/' || path[0] == '\\' || path.find(':') != std::string::npos)
+		return false;
+	size_t partStart = 0;
+	for (size_t index = 0; index <= path.size(); ++index)
+	{
+		if (index < path.size() && path[index] != '/' && path[index] != '\\')
+			continue;
+		if (index - partStart == 2 && path[partStart] == '.' && path[partStart + 1] == '.')
+			return false;
+		partStart = index + 1;
+	}
+	return true;
+}
+
+// Handles one request, and returns the reply
+std::string HandleServerRequest (SServer& server, const SServerJob& job, uint64 requestNumber)
+{
+	PROFILE_SCOPE("HandleServerRequest");
+	TClock::time_point start = TClock::now();
+	const double queueSeconds = std::chrono::duration<double>(start - job.m_received).count();
+
+	SJsonObject request;
+	std::string error;
+	if (!request.Parse(job.m_line, error))
+	{
+		server.RecordLatency(SecondsSince(job.m_received), true);
+		return "{\"status\": \"error\", \"error\": \"" + JsonEscape(error) + "\"}";
+	}
+
+	// echo the id back as it came in, so the caller can match replies to requests
+	std::string id = "null";
+	if (const SJsonObject::SField* idField = request.Find("id"))
+		id = idField->m_isString ? "\"" + JsonEscape(idField->m_value) + "\"" : idField->m_value;
+
+	if (request.GetString("command", "") == "stats")
+		return "{\"id\": " + id + ", \"status\": \"success\", " + server.Stats() + "}";
+
+	auto fail = [&] (const std::string& reason)
+	{
+		server.RecordLatency(SecondsSince(job.m_received), true);
+		return "{\"id\": " + id + ", \"status\": \"error\", \"error\": \"" + JsonEscape(reason) + "\"}";
+	};
+
+	// requests can come from any client that can reach the socket, so they only get to read and write files under the working directory
+	char defaultOutput[64];
+	sprintf(defaultOutput, ".%llu.out.bmp", (unsigned long long)requestNumber);
+	const std::string sample = request.GetString("sample", "Samples/Knot.bmp");
+	const std::string output = request.GetString("output", (sample + defaultOutput).c_str());
+	if (!IsServerPath(sample) || !IsServerPath(output))
+		return fail("sample and output must be relative paths under the server's working directory, without \"..\"");
+
+	const double tileSizeNumber = request.GetNumber("N", 2);
+	const double widthNumber = request.GetNumber("width", 48);
+	const double heightNumber = request.GetNumber("height", 48);
+	if (!(tileSizeNumber >= 2.0 && tileSizeNumber <= (double)c_maxServerTileSize))
+		return fail("N must be from 2 to " + std::to_string(c_maxServerTileSize));
+	if (!(widthNumber >= 1.0 && widthNumber <= (double)c_maxServerOutputSize && heightNumber >= 1.0 && heightNumber <= (double)c_maxServerOutputSize))
+		return fail("width and height must be from 1 to " + std::to_string(c_maxServerOutputSize));
+	const double seedNumber = request.GetNumber("seed", 0);
+	// 0xFFFFFFFF would ask SPRNG for a random seed, and the reply couldn't say which
+	if (!(seedNumber >= 0.0 && seedNumber < 4294967295.0 && seedNumber == floor(seedNumber)))
+		return fail("seed must be a whole number from 0 to 4294967294");
+
+	const size_t tileSize = (size_t)tileSizeNumber;
+	const uint8 symmetry = (uint8)std::min(std::max(1.0, request.GetNumber("symmetry", 8)), 8.0);
+	const bool periodicInput = request.GetBool("periodicInput", true);
+	const EDomain domain = request.GetBool("anchored", false) ? EDomain::e_patternAnchored : EDomain::e_patternPosition;
+	const std::string heuristic = request.GetString("heuristic", "minCount");
+	if (heuristic != "minCount" && heuristic != "shannon")
+		return fail("heuristic must be \"minCount\" or \"shannon\"");
+
+	// a build or solve that runs out of memory fails this request, not the whole server
+	try
+	{
+		bool cached = false;
+		std::shared_ptr<const SModel> model = server.m_modelCache.Get(sample, tileSize, symmetry, periodicInput, domain, cached);
+		const double modelSeconds = SecondsSince(start);
+		if (!model)
+			return fail("could not load " + sample + ", or it is smaller than N");
+
+		// solves run one per worker, so each only gets one thread
+		TClock::time_point solveStart = TClock::now();
+		SContext context(*model, (uint32)seedNumber);
+		context.m_numThreads = 1;
+		context.m_entropyHeuristic = heuristic == "shannon" ? EEntropyHeuristic::e_shannon : EEntropyHeuristic::e_minCount;
+		context.m_periodicOutput = request.GetBool("periodicOutput", true);
+		context.m_outputImageWidth = (size_t)widthNumber;
+		context.m_outputImageHeight = (size_t)heightNumber;
+		context.m_numPixels = context.m_outputImageWidth * context.m_outputImageHeight;
+		const bool success = Run(context, nullptr, false) == EObserveResult::e_success;
+		if (success && !SaveObservedImage(context, output.c_str()))
+			return fail("could not write " + output);
+		const double solveSeconds = SecondsSince(solveStart);
+
+		const double totalSeconds = SecondsSince(job.m_received);
+		server.RecordLatency(totalSeconds, !success);
+		char timings[256];
+		sprintf(timings, "\"cached\": %s, \"queueMs\": %0.3f, \"modelMs\": %0.3f, \"solveMs\": %0.3f, \"totalMs\": %0.3f",
+			cached ? "true" : "false", queueSeconds * 1000.0, modelSeconds * 1000.0, solveSeconds * 1000.0, totalSeconds * 1000.0);
+		return "{\"id\": " + id + ", \"status\": \"" + (success ? "success" : "failure") + "\", \"output\": \"" + (success ? JsonEscape(output) : "") + "\", " + timings + "}";
+	}
+	catch (const std::exception& exception)
+	{
+		return fail(std::string("could not build or solve: ") + exception.what());
+	}
+}
+
+// reads a line without the newline.  Returns false at the end of the file.
+bool ReadLine (FILE* file, std::string& line)
+{
+	line.clear();
+	char buffer[1024];
+	while (fgets(buffer, sizeof(buffer), file))
+	{
+		line += buffer;
+		if (!line.empty() && line.back() == '\n')
+		{
+			line.pop_back();
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+			return true;
+		}
+	}
+	return !line.empty();
+}
+
+void ReadServerRequests (SServer& server, FILE* file, const std::shared_ptr<SServerConnection>& connection)
+{
+	std::string line;
+	while (ReadLine(file, line))
+	{
+		if (line.find_first_not_of(" \t") == std::string::npos)
+			continue;
+		server.Push({ line, connection, TClock::now() });
+	}
+}
+
+// Runs the server on stdin and stdout, or on a unix socket if socketPath is given, with numWorkers solves at once and up to cacheSize
+// models kept built, loading and saving models through cache files if useCacheFiles is set.  Reading stdin stops at the end of the file.  The socket keeps accepting connections until the process is killed.
+int RunServer (const char* socketPath, size_t numWorkers, size_t cacheSize, bool useCacheFiles)
+{
+	if (TRACE_LEVEL() > 0 && !socketPath)
+		fprintf(stderr, "Warning: TRACE_LEVEL() is on, so traces will be mixed in with the replies on stdout\n");
+
+	// listen before starting the workers, so there are no threads to stop if it can't
+	#ifndef _WIN32
+	int listener = -1;
+	if (socketPath)
+	{
+		listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+		unlink(socketPath);
+		if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0)
+		{
+			fprintf(stderr, "Could not listen on %s\n", socketPath);
+			if (listener >= 0)
+				close(listener);
+			return 1;
+		}
+	}
+	#endif
+
+	SServer server(cacheSize, useCacheFiles);
+	std::atomic<uint64> requestNumber(0);
+	std::vector<std::thread> workers;
+	for (size_t workerIndex = 0; workerIndex < std::max<size_t>(1, numWorkers); ++workerIndex)
+	{
+		workers.emplace_back(
+			[&] ()
+			{
+				SServerJob job;
+				while (server.Pop(job))
+				{
+					std::shared_ptr<SServerConnection> connection = std::move(job.m_connection);
+					connection->Reply(HandleServerRequest(server, job, requestNumber++));
+				}
+			}
+		);
+	}
 
-        char fileName[256];
-        strcpy(fileName, context.m_fileName);
-        strcat(fileName, buffer);
+	if (socketPath)
+	{
+		#ifdef _WIN32
+		fprintf(stderr, "The server can only use stdin and stdout on windows\n");
+		#else
+		fprintf(stderr, "Listening on %s with %zu workers\n", socketPath, workers.size());
 
-        SaveImage(fileName, tempImageData);
+		// each connection gets a thread to read its requests, and the workers answer on the connection
+		while (1)
+		{
+			int connectionSocket = accept(listener, nullptr, nullptr);
+			if (connectionSocket < 0)
+				continue;
+			std::thread(
+				[&server, connectionSocket] ()
+				{
+					std::shared_ptr<SServerConnection> connection(new SServerConnection(connectionSocket));
+					FILE* file = fdopen(dup(connectionSocket), "r");
+					if (!file)
+						return;
+					ReadServerRequests(server, file, connection);
+					fclose(file);
+				}
+			).detach();
+		}
+		#endif
+	}
+	else
+		ReadServerRequests(server, stdin, std::make_shared<SServerConnection>(-1));
 
-		++patternIndex;
-    }
+	server.Close();
+	for (std::thread& worker : workers)
+		worker.join();
+	fprintf(stderr, "{%s}\n", server.Stats().c_str());
+	return 0;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//                                                UNORGANIZED
+//                                                     BENCHMARK
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-enum class EObserveResult {
-	e_success,
-	e_failure,
-	e_notDone
+// -benchmark times every stage of building a model and solving with it, separately, over a sweep of inputs and settings.  Each
+// configuration runs with seeds 0 through repeats - 1, so runs can be compared between versions, and the median and minimum of each
+// stage are reported.  After the sweep, the pattern and propagator stages are run with the generic and the specialized kernels at each
+// tile size that has specialized kernels, to show what compiling them for a fixed tile size buys.  That uses a small output, since solves get slow at
+// the larger tile sizes.  The simple tiled model is benchmarked with a synthetic tileset at every output size.
+
+static const size_t c_benchmarkTileSizes[] = { 2, 3 };
+static const uint8 c_benchmarkSymmetries[] = { 1, 8 };
+static const size_t c_benchmarkOutputSizes[] = { 16, 32, 64 };
+static const size_t c_benchmarkKernelTileSizes[] = { 2, 3, 4, 5 };
+static const size_t c_benchmarkKernelOutputSize = 8;
+static const size_t c_benchmarkTilesetTileSize = 8;
+
+enum class EBenchmarkStage
+{
+	e_load,
+	e_palletize,
+	e_patterns,
+	e_propagator,
+	e_initialize,
+	e_observe,
+	e_propagate,
+	e_save,
+	e_total,
+
+	e_count
+};
+
+static const char* c_benchmarkStageNames[(size_t)EBenchmarkStage::e_count] =
+{
+	"load", "palletize", "patterns", "propagator", "initialize", "observe", "propagate", "save", "total"
+};
+
+struct SBenchmarkResult
+{
+	std::string	m_input;
+	EModelType	m_modelType;
+	size_t		m_tileSize;
+	bool		m_specializedKernels;
+	uint8		m_symmetry;
+	size_t		m_outputSize;
+	size_t		m_numColors;
+	size_t		m_numPatterns;
+	size_t		m_numPropagatorEntries;
+	size_t		m_successes;
+	size_t		m_repeats;
+
+	double		m_medianSeconds[(size_t)EBenchmarkStage::e_count];
+	double		m_minSeconds[(size_t)EBenchmarkStage::e_count];
 };
 
-uint64 CountPixelPossibilities (SContext& context, size_t pixelBoolIndex)
+// Makes the synthetic benchmark inputs: a brick wall, which has few patterns, and blotches of random colors, which has many.  They
+// use a fixed seed and take raw mt19937 output, which is the same on every platform, so the images are too.
+std::vector<std::string> MakeBenchmarkInputs ()
 {
-	// Count how many possibilities there are
-	uint64 possiblePatternCount = 0;
-	const size_t tileSizeSq = context.m_tileSize * context.m_tileSize;
-	size_t patternPositionOffset = 0;
-	for (size_t patternIndex = 0, patternCount = context.m_patterns.size(); patternIndex < patternCount; ++patternIndex)
+	std::vector<std::string> fileNames;
+	const SPixel colors[] = { { 40, 60, 170 }, { 200, 200, 200 }, { 30, 120, 40 }, { 20, 20, 20 } };
+
+	SImageData image;
+	image.Allocate(24, 24);
+	for (size_t y = 0; y < image.m_height; ++y)
 	{
-		for (size_t positionIndex = 0, positionCount = tileSizeSq; positionIndex < positionCount; ++positionIndex, ++patternPositionOffset)
+		for (size_t x = 0; x < image.m_width; ++x)
 		{
-			if (!context.m_superPositionalPixels[pixelBoolIndex + patternPositionOffset])
-				continue;
-
-			possiblePatternCount += context.m_patterns[patternIndex].m_count;
+			bool mortar = (y % 4) == 0 || ((x + ((y / 4) % 2) * 4) % 8) == 0;
+			image.MutableRow(y)[x] = colors[mortar ? 1 : 0];
 		}
 	}
+	if (SaveImage("Benchmark.Bricks.bmp", image))
+		fileNames.push_back("Benchmark.Bricks.bmp");
 
-	return possiblePatternCount;
-}
-
-EObserveResult Observe (SContext& context, size_t& undecidedPixels)
-{
-	// Find the pixel with the smallest entropy (uncertainty), by finding the pixel with the smallest number of possibilities, which isn't yet observed/decided
-	size_t minPixelX = -1;
-    size_t minPixelY = -1;
-	uint64 minPossibilities = (uint64)-1;
-	size_t pixelIndex = 0;
-	for (size_t y = 0; y < context.m_outputImageHeight; ++y)
+	std::mt19937 rng(1);
+	for (size_t y = 0; y < image.m_height; y += 2)
 	{
-		for (size_t x = 0; x < context.m_outputImageWidth; ++x, ++pixelIndex)
+		for (size_t x = 0; x < image.m_width; x += 2)
 		{
-			// skip pixels which are already decided
-			if (context.m_observedPixels[pixelIndex].m_observedColor != EPalletIndex::e_undecided)
-				continue;
-			++undecidedPixels;
-
-			size_t boolIndex = pixelIndex * context.m_boolsPerPixel;
-			uint64 possibilities = CountPixelPossibilities(context, boolIndex);
-
-			// if no possibilities, this is an impossible pixel
-			if (possibilities == 0)
+			const SPixel& color = colors[rng() % 4];
+			for (size_t pixelY = y; pixelY < y + 2; ++pixelY)
 			{
-				TRACE(__FUNCTION__ "(): found impossible pixel: (%zu, %zu)\n", x, y);
-				return EObserveResult::e_failure;
+				for (size_t pixelX = x; pixelX < x + 2; ++pixelX)
+					image.MutableRow(pixelY)[pixelX] = color;
 			}
-
-			// otherwise, remember the minimum one we found
-            if (possibilities < minPossibilities)
-            {
-				minPossibilities = possibilities;
-				minPixelX = x;
-				minPixelY = y;
-            }
 		}
 	}
+	if (SaveImage("Benchmark.Blotches.bmp", image))
+		fileNames.push_back("Benchmark.Blotches.bmp");
+	return fileNames;
+}
 
-    // if all pixels are decided (no entropy left in the image), return success
-	if (minPossibilities == (uint64)-1)
-	{
-		return EObserveResult::e_success;
-		TRACE(__FUNCTION__ "(): all pixels decided, finished!\n");
-	}
-
-	// otherwise, select a possibility for this pixel
-	// TODO: make this a function.  ObservePixel()
-	uint64 selectedPossibility = context.m_prng.RandomInt<uint64>(0, minPossibilities-1);
-	size_t patternPositionOffset = 0;
-	const size_t tileSizeSq = context.m_tileSize * context.m_tileSize;
-	pixelIndex = minPixelY * context.m_outputImageWidth + minPixelX;
-	size_t boolIndex = pixelIndex * context.m_boolsPerPixel;
-	for (size_t patternIndex = 0, patternCount = context.m_patterns.size(); patternIndex < patternCount; ++patternIndex)
+// Makes the simple tiled model's benchmark tileset: pipes, with one tile for each of the 16 ways a pipe can leave through the middle of
+// the tile's sides.  Edges match when both tiles have a pipe there or both don't.  Returns the file name, or an empty string.
+std::string MakeBenchmarkTileset ()
+{
+	const SPixel background = { 40, 40, 40 };
+	const SPixel pipe = { 60, 180, 220 };
+	const size_t tileSize = c_benchmarkTilesetTileSize;
+	const size_t pipeBegin = tileSize / 2 - 1, pipeEnd = tileSize / 2 + 1;
+
+	SImageData image;
+	image.Allocate(tileSize * 4, tileSize * 4);
+	for (size_t tile = 0; tile < 16; ++tile)
 	{
-		const size_t currentPatternCount = context.m_patterns[patternIndex].m_count;
-		for (size_t positionIndex = 0, positionCount = tileSizeSq; positionIndex < positionCount; ++positionIndex, ++patternPositionOffset)
+		// y goes down from the top of the tile here, and rows are stored bottom to top
+		const bool left = (tile & 1) != 0, right = (tile & 2) != 0, up = (tile & 4) != 0, down = (tile & 8) != 0;
+		for (size_t y = 0; y < tileSize; ++y)
 		{
-			if (!context.m_superPositionalPixels[boolIndex + patternPositionOffset])
-				continue;
-
-			// if this is NOT the selected pattern, mark it as not possible
-			if (selectedPossibility == (uint64)-1 || selectedPossibility > currentPatternCount)
-			{
-				context.m_superPositionalPixels[boolIndex + patternPositionOffset] = false;
-				selectedPossibility -= currentPatternCount;
-			}
-			// else it IS the selected pattern, leave it as possible, and set the observed color
-			else
+			for (size_t x = 0; x < tileSize; ++x)
 			{
-				TRACE(__FUNCTION__ "(): pixel %zu,%zu decided on pattern %zu, offset %zu\n", minPixelX, minPixelY, patternIndex, positionIndex);
-				selectedPossibility = (uint64)-1;
-				context.m_observedPixels[pixelIndex].m_observedColor = context.m_patterns[patternIndex].m_pattern[positionIndex];
-				context.m_observedPixels[pixelIndex].m_patternIndex = patternIndex;
-				context.m_observedPixels[pixelIndex].m_positionIndex = positionIndex;
+				const bool alongX = y >= pipeBegin && y < pipeEnd && ((left && x < pipeEnd) || (right && x >= pipeBegin));
+				const bool alongY = x >= pipeBegin && x < pipeEnd && ((up && y < pipeEnd) || (down && y >= pipeBegin));
+				image.MutableRow(image.m_height - 1 - (tile / 4) * tileSize - y)[(tile % 4) * tileSize + x] = alongX || alongY ? pipe : background;
 			}
 		}
 	}
-
-	// mark this pixel as changed so that Propogate() knows to propagate it's changes
-	context.m_changedPixels[pixelIndex] = true;
-
-	// return that we still have more work to do
-	return EObserveResult::e_notDone;	
+	return SaveImage("Benchmark.Tiles.bmp", image) ? "Benchmark.Tiles.bmp" : "";
 }
 
-bool PatternMatches (const TPattern& patternA, const TPattern& patternB, int patternAOffsetX, int patternAOffsetY, int patternBOffsetX, int patternBOffsetY, size_t tileSize)
+SBenchmarkResult RunBenchmarkConfiguration (const std::string& input, EModelType modelType, size_t tileSize, uint8 symmetry, size_t outputSize, size_t repeats, EPropagationEngine propagationEngine, bool specializeKernels)
 {
-    int blah = -(int)tileSize + 1;
-    int blah2 = (int)tileSize;
-
-    // TODO: could easily find the min/max x and y to iterate over here
-	for (int y = -(int)tileSize+1; y < (int)tileSize; ++y)
+	SBenchmarkResult result;
+	result.m_input = input;
+	result.m_modelType = modelType;
+	result.m_tileSize = tileSize;
+	result.m_specializedKernels = specializeKernels;
+	result.m_symmetry = symmetry;
+	result.m_outputSize = outputSize;
+	result.m_numColors = 0;
+	result.m_numPatterns = 0;
+	result.m_numPropagatorEntries = 0;
+	result.m_successes = 0;
+	result.m_repeats = repeats;
+
+	std::vector<double> seconds[(size_t)EBenchmarkStage::e_count];
+	for (size_t repeat = 0; repeat < repeats; ++repeat)
 	{
-		int pay = y + patternAOffsetY;
-		int pby = y + patternBOffsetY;
-		if (pay < 0 || pby < 0 || pay >= tileSize || pby >= tileSize)
-			continue;
+		// build a fresh model every time, so building is timed too
+		SModel model;
+		model.m_type = modelType;
+		model.m_fileName = input;
+		model.m_tileSize = tileSize;
+		model.m_symmetry = symmetry;
+		model.m_periodicInput = true;
+		model.m_specializeKernels = specializeKernels;
+		if (!BuildModel(model, false))
+			break;
+		result.m_numColors = model.m_palletizedImage.m_pallete.size();
+		result.m_numPatterns = model.m_patterns.Size();
+		result.m_numPropagatorEntries = model.m_propagator.NumEntries();
+
+		SContext context(model, (uint32)repeat);
+		context.m_propagationEngine = propagationEngine;
+		context.m_periodicOutput = true;
+		context.m_outputImageWidth = outputSize;
+		context.m_outputImageHeight = outputSize;
+		context.m_numPixels = outputSize * outputSize;
+		const bool success = Run(context, nullptr, false) == EObserveResult::e_success;
+		double saveSeconds = 0.0;
+		if (success)
+		{
+			++result.m_successes;
+			TClock::time_point start = TClock::now();
+			SaveObservedImage(context, "Benchmark.out.bmp");
+			saveSeconds = SecondsSince(start);
+		}
 
-		for (int x = -(int)tileSize + 1; x < (int)tileSize; ++x)
+		double stageSeconds[(size_t)EBenchmarkStage::e_count] =
 		{
-			int pax = x + patternAOffsetX;
-			int pbx = x + patternBOffsetX;
-			if (pax < 0 || pbx < 0 || pax >= tileSize || pbx >= tileSize)
-				continue;
+			model.m_loadSeconds, model.m_palletizeSeconds, model.m_patternsSeconds, model.m_propagatorSeconds,
+			context.m_initializeSeconds, context.m_observeSeconds, context.m_propagationQueue.m_seconds, saveSeconds, 0.0
+		};
+		for (size_t stageIndex = 0; stageIndex < (size_t)EBenchmarkStage::e_total; ++stageIndex)
+			stageSeconds[(size_t)EBenchmarkStage::e_total] += stageSeconds[stageIndex];
+		for (size_t stageIndex = 0; stageIndex < (size_t)EBenchmarkStage::e_count; ++stageIndex)
+			seconds[stageIndex].push_back(stageSeconds[stageIndex]);
+	}
 
-			if (patternA[pay*tileSize + pax] != patternB[pby*tileSize + pbx])
-				return false;
-		}
+	for (size_t stageIndex = 0; stageIndex < (size_t)EBenchmarkStage::e_count; ++stageIndex)
+	{
+		std::vector<double>& stage = seconds[stageIndex];
+		std::sort(stage.begin(), stage.end());
+		result.m_medianSeconds[stageIndex] = stage.empty() ? 0.0 : stage[stage.size() / 2];
+		result.m_minSeconds[stageIndex] = stage.empty() ? 0.0 : stage[0];
 	}
-	return true;
+	return result;
 }
 
-void PropagatePatternRestrictions (SContext& context, size_t changedPixelX, size_t changedPixelY, size_t affectedPixelX, size_t affectedPixelY, int patternOffsetX, int patternOffsetY)
+const char* BenchmarkKernelsName (const SBenchmarkResult& result)
 {
-	TRACE("  affecting %zu,%zu\n", affectedPixelX, affectedPixelY);
-
-    // If any possible pattern in the affectedPixel doesn't match a possible pattern in changedPixel, mark it as impossible.
-    // Note that we need to take into account the offset between the pixels, and only care about locations that are inside both patterns.
-    size_t changedPixelIndex = changedPixelY * context.m_outputImageWidth + changedPixelX;
-    size_t affectedPixelIndex = affectedPixelY * context.m_outputImageWidth + affectedPixelX;
-
-    size_t changedPixelBoolIndex = changedPixelIndex * context.m_boolsPerPixel;
-    size_t affectedPixelBoolIndex = affectedPixelIndex * context.m_boolsPerPixel;
-
-    const size_t positionCount = context.m_tileSize * context.m_tileSize;
-
-    // Loop through the affectedPixel possible patterns to see if any are made impossible by the changed pixel's constraints
-    for (size_t affectedPixelOffset = 0; affectedPixelOffset < context.m_boolsPerPixel; ++affectedPixelOffset)
-    {
-        if (!context.m_superPositionalPixels[affectedPixelBoolIndex + affectedPixelOffset])
-            continue;
-
-        size_t affectedPatternIndex = affectedPixelOffset / positionCount;
-        size_t affectedPatternOffsetPixelIndex = affectedPixelOffset % positionCount;
-
-        size_t affectedPatternOffsetPixelX = affectedPatternOffsetPixelIndex % context.m_tileSize;
-        size_t affectedPatternOffsetPixelY = affectedPatternOffsetPixelIndex / context.m_tileSize;
-
-        const TPattern& currentAffectedPixelPattern = context.m_patterns[affectedPatternIndex].m_pattern;
-
-        // Loop through the changedPixel possible patterns to see if any match the offset affectedPixel patterns
-        bool patternOK = false;
-        for (size_t changedPixelOffset = 0; changedPixelOffset < context.m_boolsPerPixel && !patternOK; ++changedPixelOffset)
-        {
-            if (!context.m_superPositionalPixels[changedPixelBoolIndex + changedPixelOffset])
-                continue;
-
-            size_t changedPatternIndex = changedPixelOffset / positionCount;
-            size_t changedPatternOffsetPixelIndex = changedPixelOffset % positionCount;
-
-            int changedPatternOffsetPixelX = (int)(changedPatternOffsetPixelIndex % context.m_tileSize) + patternOffsetX;
-            int changedPatternOffsetPixelY = (int)(changedPatternOffsetPixelIndex / context.m_tileSize) + patternOffsetY;
-
-            const TPattern& currentChangedPixelPattern = context.m_patterns[changedPatternIndex].m_pattern;
-
-			// if we find a matching pattern, we can bail out
-			patternOK = PatternMatches(currentAffectedPixelPattern, currentChangedPixelPattern, (int)affectedPatternOffsetPixelX, (int)affectedPatternOffsetPixelY, changedPatternOffsetPixelX, changedPatternOffsetPixelY, context.m_tileSize);
-        }
-
-		bool patternOKPropagator = false;
-		const int numPatterns = (int)context.m_patterns.size();
-		const int dims = (int)context.m_tileSize * 2 - 1;
-		int px = (int)context.m_tileSize - 1 - patternOffsetX;
-		int py = (int)context.m_tileSize - 1 - patternOffsetY;
-
-		// TODO: continue getting propagator working
-
-		//std::vector<size_t>& list = context.m_propagator[(px*dims + px)*numPatterns + t];
-
-		if (patternOK != patternOKPropagator)
-		{
-			int ijkl = 0;
-		}
-
-        // if the pattern is ok, nothing else to do!
-        if (patternOK)
-            continue;
-
-		TRACE("    disabling pattern %zu, offset %zu\n", affectedPatternIndex, affectedPatternOffsetPixelIndex);
+	return result.m_specializedKernels ? "specialized" : "generic";
+}
 
-        // otherwise, disable this pattern and remember that we've changed this affectedPixel
-		context.m_superPositionalPixels[affectedPixelBoolIndex + affectedPixelOffset] = patternOK;
-		context.m_changedPixels[affectedPixelIndex] = true;
-    }
+const char* BenchmarkModelName (const SBenchmarkResult& result)
+{
+	return result.m_modelType == EModelType::e_simpleTiled ? "tiled" : "overlapping";
+}
 
-	#if TRACE_LEVEL() > 0
+bool WriteBenchmarkCSV (const char* fileName, const std::vector<SBenchmarkResult>& results)
+{
+	FILE* file = fopen(fileName, "wt");
+	if (!file)
+		return false;
+	fprintf(file, "input,model,N,kernels,symmetry,outputSize,colors,patterns,propagatorEntries,successes,repeats");
+	for (const char* stageName : c_benchmarkStageNames)
+		fprintf(file, ",%sMedianMs,%sMinMs", stageName, stageName);
+	fprintf(file, "\n");
+	for (const SBenchmarkResult& result : results)
 	{
-		size_t possibilitiesRemaining = 0;
-		for (size_t affectedPixelOffset = 0; affectedPixelOffset < context.m_boolsPerPixel; ++affectedPixelOffset)
-		{
-			if (context.m_superPositionalPixels[affectedPixelBoolIndex + affectedPixelOffset])
-				++possibilitiesRemaining;
-		}
-
-		TRACE("  %zu possibilities remaining\n", possibilitiesRemaining);
+		fprintf(file, "%s,%s,%zu,%s,%u,%zu,%zu,%zu,%zu,%zu,%zu", result.m_input.c_str(), BenchmarkModelName(result), result.m_tileSize, BenchmarkKernelsName(result), (uint32)result.m_symmetry, result.m_outputSize,
+			result.m_numColors, result.m_numPatterns, result.m_numPropagatorEntries, result.m_successes, result.m_repeats);
+		for (size_t stageIndex = 0; stageIndex < (size_t)EBenchmarkStage::e_count; ++stageIndex)
+			fprintf(file, ",%0.4f,%0.4f", result.m_medianSeconds[stageIndex] * 1000.0, result.m_minSeconds[stageIndex] * 1000.0);
+		fprintf(file, "\n");
 	}
-	#endif
+	return fclose(file) == 0;
 }
 
-bool Propagate (SContext& context)
+bool WriteBenchmarkJSON (const char* fileName, const std::vector<SBenchmarkResult>& results)
 {
-	// find a changed pixel.  If none found, return false. Else, mark the pixel as unchanged since we will handle it.
-	size_t i = 0;
-	while (i < context.m_numPixels && !context.m_changedPixels[i])
-		++i;
-	if (i >= context.m_numPixels)
+	FILE* file = fopen(fileName, "wt");
+	if (!file)
 		return false;
-	context.m_changedPixels[i] = false;
-
-	// Process all pixels that could be affected by a change to this pixel
-	size_t changedPixelX = i % context.m_outputImageWidth;
-	size_t changedPixelY = i / context.m_outputImageWidth;
-	TRACE("propagating changes for pixel %zu,%zu\n", changedPixelX, changedPixelY);
-	for (int indexY = -(int)context.m_tileSize + 1, stopY = (int)context.m_tileSize; indexY < stopY; ++indexY)
+	fprintf(file, "[\n");
+	for (size_t resultIndex = 0; resultIndex < results.size(); ++resultIndex)
 	{
-		for (int indexX = -(int)context.m_tileSize + 1, stopX = (int)context.m_tileSize; indexX < stopX; ++indexX)
+		const SBenchmarkResult& result = results[resultIndex];
+		fprintf(file, "  {\"input\": \"%s\", \"model\": \"%s\", \"N\": %zu, \"kernels\": \"%s\", \"symmetry\": %u, \"outputSize\": %zu, \"colors\": %zu, \"patterns\": %zu, \"propagatorEntries\": %zu, \"successes\": %zu, \"repeats\": %zu",
+			JsonEscape(result.m_input).c_str(), BenchmarkModelName(result), result.m_tileSize, BenchmarkKernelsName(result), (uint32)result.m_symmetry, result.m_outputSize, result.m_numColors, result.m_numPatterns,
+			result.m_numPropagatorEntries, result.m_successes, result.m_repeats);
+		for (const char* statistic : { "median", "min" })
 		{
-			// no need to process the same pixel
-			if (indexX == 0 && indexY == 0)
-				continue;
-
-			size_t affectedPixelX = (changedPixelX + indexX + context.m_outputImageWidth) % context.m_outputImageWidth;
-			size_t affectedPixelY = (changedPixelY + indexY + context.m_outputImageHeight) % context.m_outputImageHeight;
-            PropagatePatternRestrictions(context, changedPixelX, changedPixelY, affectedPixelX, affectedPixelY, indexX, indexY);
+			const double* seconds = statistic[1] == 'e' ? result.m_medianSeconds : result.m_minSeconds;
+			fprintf(file, ", \"%sMs\": {", statistic);
+			for (size_t stageIndex = 0; stageIndex < (size_t)EBenchmarkStage::e_count; ++stageIndex)
+				fprintf(file, "%s\"%s\": %0.4f", stageIndex > 0 ? ", " : "", c_benchmarkStageNames[stageIndex], seconds[stageIndex] * 1000.0);
+			fprintf(file, "}");
 		}
+		fprintf(file, "}%s\n", resultIndex + 1 < results.size() ? "," : "");
 	}
-
-	// return that we did do some work
-	return true;
+	fprintf(file, "]\n");
+	return fclose(file) == 0;
 }
 
-void PropagateAllChanges (SContext& context)
+void PrintBenchmarkRow (const SBenchmarkResult& result)
 {
-	// Propagate until no progress can be made
-	while (Propagate(context));
+	printf("%-24s %2zu %3u %5zu %8zu", result.m_input.c_str(), result.m_tileSize, (uint32)result.m_symmetry, result.m_outputSize, result.m_numPatterns);
+	for (double seconds : result.m_medianSeconds)
+		printf(" %10.3f", seconds * 1000.0);
+	printf("  %zu/%zu\n", result.m_successes, result.m_repeats);
+	fflush(stdout);
 }
 
-void SaveFinalImage (SContext& context)
+// Benchmarks the sample plus the synthetic inputs over every tile size, symmetry and output size, or only outputSize if it isn't 0,
+// and the synthetic tileset over every output size.
+// Prints a table of median times, and writes every statistic to csvFileName and jsonFileName when they are given.
+int RunBenchmark (const std::string& sample, size_t repeats, size_t outputSize, EPropagationEngine propagationEngine, const char* csvFileName, const char* jsonFileName)
 {
-	// allocate space for the image
-	SImageData tempImageData;
-	tempImageData.m_width = context.m_outputImageWidth;
-	tempImageData.m_height = context.m_outputImageHeight;
-	tempImageData.m_pitch = context.m_outputImageWidth * 3;
-	if (tempImageData.m_pitch & 3)
+	std::vector<std::string> inputs = MakeBenchmarkInputs();
+	inputs.insert(inputs.begin(), sample);
+
+	std::vector<size_t> outputSizes(std::begin(c_benchmarkOutputSizes), std::end(c_benchmarkOutputSizes));
+	if (outputSize > 0)
+		outputSizes.assign(1, outputSize);
+
+	printf("Benchmark, %zu repeats, median ms per stage\n", repeats);
+	printf("%-24s %2s %3s %5s %8s", "input", "N", "sym", "size", "patterns");
+	for (const char* stageName : c_benchmarkStageNames)
+		printf(" %10s", stageName);
+	printf("  successes\n");
+
+	std::vector<SBenchmarkResult> results;
+	for (const std::string& input : inputs)
+	{
+		for (size_t tileSize : c_benchmarkTileSizes)
+		{
+			for (uint8 symmetry : c_benchmarkSymmetries)
+			{
+				for (size_t size : outputSizes)
+				{
+					results.push_back(RunBenchmarkConfiguration(input, EModelType::e_overlapping, tileSize, symmetry, size, repeats, propagationEngine, true));
+					PrintBenchmarkRow(results.back());
+				}
+			}
+		}
+	}
+
+	// the simple tiled model's tiles are patterns too, so it goes in the same table
+	const std::string tileset = MakeBenchmarkTileset();
+	for (size_t sizeIndex = 0; sizeIndex < outputSizes.size() && !tileset.empty(); ++sizeIndex)
 	{
-		tempImageData.m_pitch &= ~3;
-		tempImageData.m_pitch += 4;
+		results.push_back(RunBenchmarkConfiguration(tileset, EModelType::e_simpleTiled, c_benchmarkTilesetTileSize, 1, outputSizes[sizeIndex], repeats, propagationEngine, true));
+		PrintBenchmarkRow(results.back());
 	}
-	tempImageData.m_pixels.resize(tempImageData.m_pitch*tempImageData.m_height);
 
-	// set the output image pixels , based on the observed colors
-	const SObservedPixel* srcPixel = &context.m_observedPixels[0];
-	for (size_t y = 0; y < context.m_outputImageHeight; ++y)
+	// the same stages with the generic and the specialized kernels
+	static const EBenchmarkStage c_kernelStages[] = { EBenchmarkStage::e_patterns, EBenchmarkStage::e_propagator };
+	printf("\nKernels, %s at %zu x %zu, median ms generic / specialized (speedup)\n", sample.c_str(), c_benchmarkKernelOutputSize, c_benchmarkKernelOutputSize);
+	printf("%2s", "N");
+	for (EBenchmarkStage stage : c_kernelStages)
+		printf(" %28s", c_benchmarkStageNames[(size_t)stage]);
+	printf("\n");
+	for (size_t tileSize : c_benchmarkKernelTileSizes)
 	{
-		SPixel* destPixel = (SPixel*)&tempImageData.m_pixels[y*tempImageData.m_pitch];
-		for (size_t x = 0; x < context.m_outputImageWidth; ++x, ++destPixel, ++srcPixel)
+		results.push_back(RunBenchmarkConfiguration(sample, EModelType::e_overlapping, tileSize, 8, c_benchmarkKernelOutputSize, repeats, propagationEngine, false));
+		results.push_back(RunBenchmarkConfiguration(sample, EModelType::e_overlapping, tileSize, 8, c_benchmarkKernelOutputSize, repeats, propagationEngine, true));
+		const SBenchmarkResult& generic = results[results.size() - 2];
+		const SBenchmarkResult& specialized = results.back();
+		printf("%2zu", tileSize);
+		for (EBenchmarkStage stage : c_kernelStages)
 		{
-			// TODO: handle the srcPixel being undecided!
-			*destPixel = context.m_palletizedImage.m_pallete[(size_t)srcPixel->m_observedColor];
+			const double genericSeconds = generic.m_medianSeconds[(size_t)stage];
+			const double specializedSeconds = specialized.m_medianSeconds[(size_t)stage];
+			printf(" %10.3f / %10.3f (%4.2fx)", genericSeconds * 1000.0, specializedSeconds * 1000.0, specializedSeconds > 0.0 ? genericSeconds / specializedSeconds : 0.0);
 		}
+		printf("\n");
+		fflush(stdout);
 	}
 
-	// write the file
-	char fileName[256];
-	strcpy(fileName, context.m_fileName);
-	strcat(fileName, ".out.bmp");
-	SaveImage(fileName, tempImageData);
+	bool success = true;
+	if (csvFileName && !WriteBenchmarkCSV(csvFileName, results))
+	{
+		fprintf(stderr, "Could not write %s\n", csvFileName);
+		success = false;
+	}
+	if (jsonFileName && !WriteBenchmarkJSON(jsonFileName, results))
+	{
+		fprintf(stderr, "Could not write %s\n", jsonFileName);
+		success = false;
+	}
+	return success ? 0 : 1;
 }
 
-
-
 int main(int argc, char **argv)
 {
-	// TODO: could move all this calculation stuff into a "run" function that takes the params as function params?
-
 	/*
 	// Parameters
-	SContext context(0); // TODO: temp! remove this param so seed goes back to -1
-	context.m_tileSize = 3;
-	context.m_fileName = "Samples\\Knot.bmp";;
-	context.m_periodicInput = true;
+	SModel model;
+	model.m_tileSize = 3;
+	model.m_fileName = "Samples\\Knot.bmp";
+	model.m_periodicInput = true;
+	model.m_symmetry = 8;
+	...
 	context.m_periodicOutput = true;
-	context.m_symmetry = 8;
 	context.m_outputImageWidth = 6;
 	context.m_outputImageHeight = 6;
-	context.m_numPixels = context.m_outputImageWidth * context.m_outputImageHeight;
 	*/
 
-	SContext context(0); // TODO: temp! remove this param so seed goes back to -1
-	context.m_tileSize = 2;
-	context.m_fileName = "Samples\\Knot.bmp";;
-	context.m_periodicInput = true;
-	context.m_periodicOutput = true;
-	context.m_symmetry = 8;
-	context.m_outputImageWidth = 3;
-	context.m_outputImageHeight = 3;
-	context.m_numPixels = context.m_outputImageWidth * context.m_outputImageHeight;
-
-    // Load image
-	if (!LoadImage(context.m_fileName, context.m_colorImage)) {
-		fprintf(stderr, "Could not load image: %s\n", context.m_fileName);
-		return 1;
+	SModel model;
+	model.m_tileSize = 2;
+	model.m_fileName = "Samples/Knot.bmp";
+	model.m_periodicInput = true;
+	model.m_symmetry = 8;
+
+	// -scaling reports how the parallel stages scale with thread count
+	// -anchored solves with one possibility per pattern per pixel instead of one per pattern and position
+	// -parallel propagates with the compatibility table on m_numThreads threads
+	// -shannon observes the cell with the least shannon entropy next, instead of the one with the smallest total pattern count
+	// -portfolio K solves with K seeds at once and keeps the first success
+	// -backtrack D undoes up to D decisions on a contradiction instead of failing
+	// -backjump K undoes K decisions at a time when backtracking
+	// -undomb M lets the undo log grow to M megabytes before the oldest decisions are made permanent (256 by default)
+	// -maxbacktracks K gives up after K backtracks (100000 by default)
+	// -size W H sets the output size
+	// -sample F solves with the overlapping model, using the sample image F (Samples/Knot.bmp by default)
+	// -N n sets the overlapping model's pattern size to n x n (2 by default)
+	// -chunked C generates the output in C x C chunks and streams it to disk, for outputs too big to solve at once
+	// -modify B S modifies the output in B x B blocks for S seconds, for outputs too big to solve at once without contradictions
+	// -server answers JSON requests from stdin, one per line, keeping built models cached between requests
+	// -socket P answers JSON requests on the unix socket P instead of stdin.  Anyone who can connect to P can read any image under the
+	//   working directory and write files anywhere under it, so P should only be reachable by trusted users.
+	// -workers K solves up to K requests at once
+	// -cache K keeps up to K built models
+	// -benchmark R times each stage over a sweep of inputs, tile sizes, symmetries and output sizes, with seeds 0 to R-1, then compares the
+	//   generic and specialized kernels
+	// -generic uses the generic kernels even for tile sizes that have specialized ones
+	// -csv F and -json F write the benchmark results to F
+	// -modelcache loads the built model from a cache file next to the image, writing the file if it's missing or stale
+	// -stream F writes the output to F (a .bmp or .ppm) a row at a time on an I/O thread as rows are finished, instead of at the end
+	// -trace F writes every profiled scope to F as a chrome://tracing JSON file when the program exits
+	// -pin X Y R G B pins output pixel (X, Y) to a color from the sample.  Y counts up from the bottom row, like BMP rows.
+	// -pinpattern X Y P pins output pixel (X, Y) to pattern P, anchored there
+	// -seeds K solves with K seeds in a row, starting each one from the pins propagated once, and saves each success
+	// -tiled F N solves with the simple tiled model, using the N x N tiles of the tileset image F.  Each output pixel is a tile.
+	// -rules F reads the simple tiled model's adjacency rules and tile weights from F, see LoadTileRules()
+	bool reportScaling = false;
+	bool parallelPropagation = false;
+	bool shannonEntropy = false;
+	size_t portfolioSize = 1;
+	size_t backtrackDepth = 0;
+	size_t backjump = 1;
+	size_t undoMegabytes = 0;
+	uint64 maxBacktracks = 0;
+	size_t outputImageWidth = 0;
+	size_t outputImageHeight = 0;
+	size_t chunkSize = 0;
+	size_t modifyBlockSize = 0;
+	size_t overlappingTileSize = 0;
+	double modifySeconds = 0.0;
+	bool server = false;
+	const char* socketPath = nullptr;
+	size_t numWorkers = GetDefaultThreadCount();
+	size_t cacheSize = 8;
+	size_t benchmarkRepeats = 0;
+	const char* csvFileName = nullptr;
+	const char* jsonFileName = nullptr;
+	const char* traceFileName = nullptr;
+	const char* streamFileName = nullptr;
+	std::vector<std::array<int, 5>> colorPins;
+	std::vector<std::array<int, 3>> patternPins;
+	size_t numSeeds = 0;
+	for (int argIndex = 1; argIndex < argc; ++argIndex)
+	{
+		if (!strcmp(argv[argIndex], "-scaling"))
+			reportScaling = true;
+		else if (!strcmp(argv[argIndex], "-anchored"))
+			model.m_domain = EDomain::e_patternAnchored;
+		else if (!strcmp(argv[argIndex], "-parallel"))
+			parallelPropagation = true;
+		else if (!strcmp(argv[argIndex], "-shannon"))
+			shannonEntropy = true;
+		else if (!strcmp(argv[argIndex], "-portfolio") && argIndex + 1 < argc)
+			portfolioSize = std::max(1, atoi(argv[++argIndex]));
+		else if (!strcmp(argv[argIndex], "-backtrack") && argIndex + 1 < argc)
+			backtrackDepth = std::max(0, atoi(argv[++argIndex]));
+		else if (!strcmp(argv[argIndex], "-backjump") && argIndex + 1 < argc)
+			backjump = std::max(1, atoi(argv[++argIndex]));
+		else if (!strcmp(argv[argIndex], "-undomb") && argIndex + 1 < argc)
+			undoMegabytes = std::max(1, atoi(argv[++argIndex]));
+		else if (!strcmp(argv[argIndex], "-maxbacktracks") && argIndex + 1 < argc)
+			maxBacktracks = (uint64)std::max(1LL, atoll(argv[++argIndex]));
+		else if (!strcmp(argv[argIndex], "-size") && argIndex + 2 < argc)
+		{
+			outputImageWidth = std::max(1, atoi(argv[++argIndex]));
+			outputImageHeight = std::max(1, atoi(argv[++argIndex]));
+		}
+		else if (!strcmp(argv[argIndex], "-chunked") && argIndex + 1 < argc)
+			chunkSize = std::max(1, atoi(argv[++argIndex]));
+		else if (!strcmp(argv[argIndex], "-modify") && argIndex + 2 < argc)
+		{
+			modifyBlockSize = std::max(1, atoi(argv[++argIndex]));
+			modifySeconds = atof(argv[++argIndex]);
+		}
+		else if (!strcmp(argv[argIndex], "-server"))
+			server = true;
+		else if (!strcmp(argv[argIndex], "-socket") && argIndex + 1 < argc)
+		{
+			server = true;
+			socketPath = argv[++argIndex];
+		}
+		else if (!strcmp(argv[argIndex], "-workers") && argIndex + 1 < argc)
+			numWorkers = std::max(1, atoi(argv[++argIndex]));
+		else if (!strcmp(argv[argIndex], "-cache") && argIndex + 1 < argc)
+			cacheSize = std::max(1, atoi(argv[++argIndex]));
+		else if (!strcmp(argv[argIndex], "-modelcache"))
+			model.m_useCacheFile = true;
+		else if (!strcmp(argv[argIndex], "-generic"))
+			model.m_specializeKernels = false;
+		else if (!strcmp(argv[argIndex], "-benchmark") && argIndex + 1 < argc)
+			benchmarkRepeats = std::max(1, atoi(argv[++argIndex]));
+		else if (!strcmp(argv[argIndex], "-csv") && argIndex + 1 < argc)
+			csvFileName = argv[++argIndex];
+		else if (!strcmp(argv[argIndex], "-json") && argIndex + 1 < argc)
+			jsonFileName = argv[++argIndex];
+		else if (!strcmp(argv[argIndex], "-trace") && argIndex + 1 < argc)
+			traceFileName = argv[++argIndex];
+		else if (!strcmp(argv[argIndex], "-stream") && argIndex + 1 < argc)
+			streamFileName = argv[++argIndex];
+		else if (!strcmp(argv[argIndex], "-sample") && argIndex + 1 < argc)
+		{
+			model.m_type = EModelType::e_overlapping;
+			model.m_fileName = argv[++argIndex];
+		}
+		else if (!strcmp(argv[argIndex], "-N") && argIndex + 1 < argc)
+			overlappingTileSize = std::max(2, atoi(argv[++argIndex]));
+		else if (!strcmp(argv[argIndex], "-tiled") && argIndex + 2 < argc)
+		{
+			model.m_type = EModelType::e_simpleTiled;
+			model.m_fileName = argv[++argIndex];
+			model.m_tileSize = std::max(1, atoi(argv[++argIndex]));
+		}
+		else if (!strcmp(argv[argIndex], "-rules") && argIndex + 1 < argc)
+			model.m_rulesFileName = argv[++argIndex];
+		else if (!strcmp(argv[argIndex], "-pin") && argIndex + 5 < argc)
+		{
+			colorPins.push_back({ { atoi(argv[argIndex + 1]), atoi(argv[argIndex + 2]), atoi(argv[argIndex + 3]), atoi(argv[argIndex + 4]), atoi(argv[argIndex + 5]) } });
+			argIndex += 5;
+		}
+		else if (!strcmp(argv[argIndex], "-pinpattern") && argIndex + 3 < argc)
+		{
+			patternPins.push_back({ { atoi(argv[argIndex + 1]), atoi(argv[argIndex + 2]), atoi(argv[argIndex + 3]) } });
+			argIndex += 3;
+		}
+		else if (!strcmp(argv[argIndex], "-seeds") && argIndex + 1 < argc)
+			numSeeds = std::max(1, atoi(argv[++argIndex]));
 	}
 
-    // Palletize the image for simpler processing of pixels
-    PalletizeImage(context.m_colorImage, context.m_palletizedImage);
-
-    // Gather the patterns from the source data
-    GetPatterns(context);
+	// -N only sizes the overlapping model's patterns, -tiled F N gives the tile size
+	if (overlappingTileSize > 0 && model.m_type == EModelType::e_overlapping)
+		model.m_tileSize = overlappingTileSize;
 
-	// TODO: temp!
+	#if PROFILE_LEVEL() > 0
+	// report the profile on the way out, however main returns
+	struct SProfileReport
 	{
-		context.m_patterns.clear();
-		context.m_patterns.resize(2);
+		~SProfileReport ()
+		{
+			SProfiler& profiler = SProfiler::Get();
+			profiler.Report(stderr);
+			if (m_traceFileName && !profiler.WriteChromeTrace(m_traceFileName))
+				fprintf(stderr, "Could not write %s\n", m_traceFileName);
+		}
+		const char* m_traceFileName;
+	} profileReport = { traceFileName };
+	SProfiler::Get().m_recordEvents = traceFileName != nullptr;
+	#endif
+
+	if (benchmarkRepeats > 0)
+		return RunBenchmark(model.m_fileName, benchmarkRepeats, outputImageWidth, parallelPropagation ? EPropagationEngine::e_parallelCompatibilityTable : EPropagationEngine::e_supportCounters, csvFileName, jsonFileName);
 
-		context.m_patterns[0].m_count = 1;
-		context.m_patterns[0].m_pattern.resize(4);
-		context.m_patterns[0].m_pattern = {(EPalletIndex)1,(EPalletIndex)0,(EPalletIndex)1,(EPalletIndex)0};
+	if (server)
+		return RunServer(socketPath, numWorkers, cacheSize, model.m_useCacheFile);
 
-		context.m_patterns[1].m_count = 1;
-		context.m_patterns[1].m_pattern.resize(4);
-		context.m_patterns[1].m_pattern = { (EPalletIndex)1,(EPalletIndex)1,(EPalletIndex)0,(EPalletIndex)0 };
+	if (!BuildModel(model, reportScaling))
+	{
+		if (model.m_type == EModelType::e_simpleTiled)
+			fprintf(stderr, "Could not build the simple tiled model from %s\n", model.m_fileName.c_str());
+		else
+			fprintf(stderr, "Could not load image, or it is smaller than %zu x %zu: %s\n", model.m_tileSize, model.m_tileSize, model.m_fileName.c_str());
+		return 1;
 	}
+	if (model.m_loadedFromCache)
+		printf("Loaded %zu x %zu image's model from %s: %zu colors, %zu patterns in %0.3f ms\n", model.m_palletizedImage.m_width, model.m_palletizedImage.m_height, ModelCacheFileName(model).c_str(), model.m_palletizedImage.m_pallete.size(), model.m_patterns.Size(), model.m_loadSeconds * 1000.0);
+	else
+		printf("Palletized %zu x %zu image: %zu colors in %0.3f ms\n", model.m_palletizedImage.m_width, model.m_palletizedImage.m_height, model.m_palletizedImage.m_pallete.size(), model.m_palletizeSeconds * 1000.0);
 
-	context.m_boolsPerPixel = context.m_patterns.size() * context.m_tileSize * context.m_tileSize;
+	if (model.m_type == EModelType::e_simpleTiled)
+		printf("Cut %zu %zu x %zu tiles in %0.3f ms, built adjacency in %0.3f ms\n", model.m_patterns.Size(), model.m_tileSize, model.m_tileSize, model.m_patternsSeconds * 1000.0, model.m_propagatorSeconds * 1000.0);
 
-	// generate propagator
-	// TODO: move this into a function
-	int numPatterns = (int)context.m_patterns.size();
-	auto agrees = [numPatterns] (const TPattern& A, const TPattern& B, int dx, int dy)
-	{
-		// TODO; re-write when working?
-		const int N = numPatterns;
+	// Uncomment to see the patterns found
+	//SavePatterns(model);
 
-		int xmin = dx < 0 ? 0 : dx;
-		int xmax = dx < 0 ? dx + N : N;
-		int ymin = dy < 0 ? 0 : dy;
-		int ymax = dy < 0 ? dy + N : N;
-		for (int y = ymin; y < ymax; y++)
+	SContext context(model, 0); // TODO: temp! remove this param so seed goes back to -1
+	context.m_periodicOutput = true;
+	context.m_outputImageWidth = 3;
+	context.m_outputImageHeight = 3;
+	if (outputImageWidth > 0)
+	{
+		context.m_outputImageWidth = outputImageWidth;
+		context.m_outputImageHeight = outputImageHeight;
+	}
+	context.m_numPixels = context.m_outputImageWidth * context.m_outputImageHeight;
+	if (parallelPropagation)
+		context.m_propagationEngine = EPropagationEngine::e_parallelCompatibilityTable;
+	if (shannonEntropy)
+		context.m_entropyHeuristic = EEntropyHeuristic::e_shannon;
+	context.m_undoLog.m_maxDepth = backtrackDepth;
+	context.m_undoLog.m_backjump = backjump;
+	if (undoMegabytes > 0)
+		context.m_undoLog.m_maxBytes = undoMegabytes * 1024 * 1024;
+	if (maxBacktracks > 0)
+		context.m_undoLog.m_maxBacktracks = maxBacktracks;
+
+	// pins are in output pixels, so they need the output size
+	const std::vector<SPixel>& pallete = model.m_palletizedImage.m_pallete;
+	for (const std::array<int, 5>& pin : colorPins)
+	{
+		const SPixel color = { (uint8)pin[4], (uint8)pin[3], (uint8)pin[2] };
+		const size_t colorIndex = std::find(pallete.begin(), pallete.end(), color) - pallete.begin();
+		if ((size_t)pin[0] >= context.m_outputImageWidth || (size_t)pin[1] >= context.m_outputImageHeight || colorIndex == pallete.size())
 		{
-			for (int x = xmin; x < xmax; x++)
-			{
-				if (A[x + N * y] != B[x - dx + N * (y - dy)])
-					return false;
-			}
+			fprintf(stderr, "Can't pin %d,%d to %d %d %d: it isn't in the output, or the color isn't in the sample\n", pin[0], pin[1], pin[2], pin[3], pin[4]);
+			return 1;
 		}
-		return true;
-	};
-
-	int dims = (int)context.m_tileSize * 2 - 1;
-	context.m_propagator.resize(dims*dims*numPatterns);
-	for (int y = 0; y < dims; ++y)
+		PinColor(context, pin[0], pin[1], (uint32)colorIndex);
+	}
+	for (const std::array<int, 3>& pin : patternPins)
 	{
-		for (int x = 0; x < dims; ++x)
+		if ((size_t)pin[0] >= context.m_outputImageWidth || (size_t)pin[1] >= context.m_outputImageHeight || (size_t)pin[2] >= model.m_patterns.Size())
 		{
-			for (int t = 0; t < numPatterns; ++t)
-			{
-				if (x == dims - 1 && y == dims - 1 && t == numPatterns - 1)
-				{
-					int ijkl = 0;
-				}
-				std::vector<size_t>& list = context.m_propagator[(y*dims+x)*numPatterns + t];
-
-				for (int t2 = 0; t2 < numPatterns; t2++)
-				{
-					if (agrees(context.m_patterns[t].m_pattern, context.m_patterns[t2].m_pattern, x - numPatterns + 1, y - numPatterns + 1))
-						list.push_back(t2);
-				}
-			}
+			fprintf(stderr, "Can't pin %d,%d to pattern %d: it isn't in the output, or there are only %zu patterns\n", pin[0], pin[1], pin[2], model.m_patterns.Size());
+			return 1;
 		}
+		PinPattern(context, pin[0], pin[1], pin[2]);
 	}
 
-	// initialize our superpositional pixel information which describes which patterns in what positions each pixel has as a possibility
-	// TODO: make this stuff happen in the context constructor
-	context.m_superPositionalPixels.resize(context.m_numPixels*context.m_boolsPerPixel, true);
+	// chunks and blocks are stitched together by overlapping patterns, which tiles don't have
+	if (model.m_type == EModelType::e_simpleTiled && (chunkSize > 0 || modifyBlockSize > 0 || reportScaling))
+	{
+		printf("The simple tiled model solves the whole output at once, ignoring -chunked, -modify and -scaling\n");
+		chunkSize = modifyBlockSize = 0;
+		reportScaling = false;
+	}
 
-	// initialize our observed colors for each pixel, which starts out as undecided
-	context.m_observedPixels.resize(context.m_numPixels, { EPalletIndex::e_undecided, (size_t)-1, (size_t)-1 });
+	if (reportScaling)
+		ReportPropagationScaling(context);
 
-	// initialize which pixels have been changed - starting with none (all false)
-	context.m_changedPixels.resize(context.m_numPixels, false);
+	if ((chunkSize > 0 || modifyBlockSize > 0) && (!colorPins.empty() || !patternPins.empty()))
+		printf("Chunks and blocks pin their own pixels, ignoring -pin and -pinpattern\n");
 
-	// Uncomment to see the patterns found
-	//SavePatterns(context);
+	// chunked generation writes the image as it goes
+	if (chunkSize > 0)
+	{
+		if (RunChunked(context, chunkSize) != EObserveResult::e_success)
+		{
+			NTRACE("failure!\n");
+			return 1;
+		}
+		NTRACE("success\n");
+		return 0;
+	}
 
-	// Do wave collapse
-	EObserveResult observeResult = EObserveResult::e_notDone;
-    uint32 lastPercent = 0;
-    NTRACE("Progress: 0%%");
-	while (1)
+	// modifying in blocks leaves the output in the context's observed pixels
+	if (modifyBlockSize > 0)
 	{
-		size_t undecidedPixels = 0;
-		observeResult = Observe(context, undecidedPixels);
-		if (observeResult != EObserveResult::e_notDone)
-			break;
+		if (RunModifyInBlocks(context, modifyBlockSize, modifySeconds) != EObserveResult::e_success)
+		{
+			NTRACE("failure!\n");
+			return 1;
+		}
+		NTRACE("success\n");
+		return SaveFinalImage(context) ? 0 : 1;
+	}
 
-        uint32 percent = 100 - uint32(100.0f * float(undecidedPixels) / float(context.m_numPixels));
-        
-        if (lastPercent != percent)
-        {
-            NTRACE("\rProgress: %i%%", percent);
-            lastPercent = percent;
-        }
+	// many seeds from the same pins, each saved to it's own file
+	if (numSeeds > 0)
+	{
+		if (streamFileName || portfolioSize > 1)
+			printf("Each seed saves it's own image and solves alone, ignoring -stream and -portfolio\n");
+		size_t numUnsaved = 0;
+		return RunSeeds(context, numSeeds, numUnsaved) > 0 && numUnsaved == 0 ? 0 : 1;
+	}
 
-		PropagateAllChanges(context);
+	// stream the output as it's solved, if asked to.  Each solver in a portfolio would need it's own file, so they don't stream.
+	SImageStreamWriter streamWriter;
+	if (streamFileName && portfolioSize > 1)
+		printf("Can't stream a portfolio's output, ignoring -stream\n");
+	else if (streamFileName)
+	{
+		const size_t pixelsPerPixel = OutputPixelsPerPixel(model);
+		if (!streamWriter.Open(streamFileName, context.m_outputImageWidth * pixelsPerPixel, context.m_outputImageHeight * pixelsPerPixel))
+		{
+			fprintf(stderr, "Could not write image: %s\n", streamFileName);
+			return 1;
+		}
+		context.m_streamWriter = &streamWriter;
+	}
+
+	// Solve, either just this context or a portfolio of seeds starting with this one
+	std::vector<std::unique_ptr<SContext>> solvers;
+	SContext* result = &context;
+	EObserveResult observeResult;
+	if (portfolioSize > 1)
+	{
+		size_t winnerIndex = 0;
+		observeResult = RunPortfolio(context, portfolioSize, solvers, winnerIndex);
+		result = solvers[winnerIndex].get();
 	}
+	else
+		observeResult = Run(context, nullptr, true);
 
 	if (observeResult == EObserveResult::e_success)
 		NTRACE("success");
 	else
 		NTRACE("failure!");
 
-    // Save the final image
-	SaveFinalImage(context);
-	return 0;
+	const SPropagationQueue& queue = result->m_propagationQueue;
+	NTRACE("\nPropagation: %llu queue entries processed, max queue depth %zu, %0.2f ms (%0.0f entries/sec)\n",
+		(unsigned long long)queue.m_pops, queue.m_maxDepth, queue.m_seconds * 1000.0, queue.m_seconds > 0.0 ? double(queue.m_pops) / queue.m_seconds : 0.0);
+	const SUndoLog& undoLog = result->m_undoLog;
+	if (undoLog.Enabled())
+		NTRACE("Backtracking: %llu backtracks, %llu KB restored, %zu KB peak undo log, %llu commits\n", (unsigned long long)undoLog.m_backtracks,
+			(unsigned long long)(undoLog.m_restoredBytes / 1024), undoLog.m_maxBytesUsed / 1024, (unsigned long long)undoLog.m_commits);
+	NTRACE("%s domain: %zu possibilities per pixel, %zu KB of wave, %zu KB of support counts\n",
+		model.m_type == EModelType::e_simpleTiled ? "Tile" : model.m_domain == EDomain::e_patternAnchored ? "Anchored" : "Pattern x position",
+		model.m_boolsPerPixel, result->m_wave.m_words.size() * sizeof(uint64) / 1024, (result->m_supportCounts.size() + result->m_positionSupportCounts.size()) * sizeof(uint32) / 1024);
+
+	// A streamed image only needs the rows that never finished, and it's header.  Otherwise save the final image.
+	if (context.m_streamWriter)
+	{
+		const uint64 rowsWrittenDuringSolve = streamWriter.RowsWritten();
+		StreamUnfinishedRows(context);
+		if (!streamWriter.Close())
+		{
+			fprintf(stderr, "Could not write image: %s\n", streamFileName);
+			return 1;
+		}
+		NTRACE("Streamed: %llu rows queued, %llu written before the solve finished, %0.2f ms writing on the I/O thread\n",
+			(unsigned long long)streamWriter.RowsQueued(), (unsigned long long)rowsWrittenDuringSolve, streamWriter.WriteSeconds() * 1000.0);
+	}
+	else if (!SaveFinalImage(*result))
+		return 1;
+
+	// a failed solve still saves what it decided, with the rest black, but reports the failure
+	return observeResult == EObserveResult::e_success ? 0 : 1;
 }
 
 /*
 
 TODO:
 
-* make propagator.  Use propagator.  See if propagator works.  Find any time where your code and propagator disagree.
-
 * get rid of trace calls once it's working
 
 ! print out the things you were writing out by hand, to be able to debug more quickly and get a better idea of what's going on.
@@ -921,8 +6725,6 @@ TODO:
 
 * make sure periodic input and periodic output params are honored
 
-* support ground feature where there are specific pixels that are initialized and can't be changed.
-
 * test! Maybe do all the tests from that XML file
 
 * could break up the code into commented sections to help organize it, even though it's just a single file.
@@ -966,7 +6768,6 @@ TODO:
    * could regenerate several different things from the same constraints.  To re-roll something if you don't like it.  Or, to make variety without changing things that you actually care about.
 
 * Next:
- * simple tiled model
  * make some fast CPU version? multithreaded, focused on speed etc.
  * JFA?
 